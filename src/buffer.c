@@ -30,6 +30,32 @@ bool write_buf(buffer* buf, char value)
   return write_buf_inc(buf, value, default_increment);
 }
 
+bool write_buf_str(buffer *buf, const char *str)
+{
+  return write_buf_mem(buf, str, strlen(str));
+}
+
+bool write_buf_mem(buffer *buf, const char *str, size_t len)
+{
+  if(buf->pos + len > buf->size) {
+    size_t size = buf->size * 2 > buf->pos + len ? buf->size * 2 : buf->pos + len;
+    char *new_ptr = realloc(buf->ptr, size);
+
+    if(!new_ptr) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      return true;
+    }
+
+    buf->ptr = new_ptr;
+    buf->size = size;
+  }
+
+  memcpy(buf->ptr + buf->pos, str, len);
+  buf->pos += len;
+
+  return false;
+}
+
 char *buf_to_str(buffer *buf, bool free_buf)
 {
   char *str = NULL;
@@ -59,3 +85,16 @@ char *strdup(const char *src)
   memcpy (dst, src, len);
   return dst;
 }
+
+char *strndup(const char *src, size_t len)
+{
+  size_t src_len = 0;
+  while(src_len < len && src[src_len] != '\0')
+    src_len++;
+  char *dst = malloc(src_len + 1);
+  if(dst == NULL)
+    return NULL;
+  memcpy(dst, src, src_len);
+  dst[src_len] = '\0';
+  return dst;
+}
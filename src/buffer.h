@@ -12,8 +12,11 @@ typedef struct buffer {
 
 bool write_buf_inc(buffer *buf, char value, size_t buf_inc);
 bool write_buf(buffer* buf, char value);
+bool write_buf_str(buffer *buf, const char *str);
+bool write_buf_mem(buffer *buf, const char *str, size_t len);
 char *buf_to_str(buffer *buf, bool free_buf);
 
 char *strdup(const char *src);
+char *strndup(const char *src, size_t len);
 
 #endif
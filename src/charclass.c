@@ -0,0 +1,30 @@
+#include "charclass.h"
+
+#define SP CC_SPACE
+#define AL CC_ALPHA
+#define DI CC_DIGIT
+#define PU CC_PUNCT
+#define NS CC_NUM_START
+#define NC CC_NUM
+#define MS CC_NAME_START
+#define MC CC_NAME
+
+const unsigned char char_classes[256] = {
+  0,            0,            0,            0,            0,            0,            0,            0, // 00 01 02 03 04 05 06 07
+  0,            SP,           SP,           SP,           SP,           SP,           0,            0, // 08 09 0a 0b 0c 0d 0e 0f
+  0,            0,            0,            0,            0,            0,            0,            0, // 10 11 12 13 14 15 16 17
+  0,            0,            0,            0,            0,            0,            0,            0, // 18 19 1a 1b 1c 1d 1e 1f
+  SP,           PU,           PU,           PU,           PU,           PU,           PU,           PU, // 20 ! " # $ % & '
+  PU,           PU,           PU,           PU|NC,        PU,           PU|NC,        PU|NS|NC,     PU, // ( ) * + , - . /
+  DI|NS|NC|MC,  DI|NS|NC|MC,  DI|NS|NC|MC,  DI|NS|NC|MC,  DI|NS|NC|MC,  DI|NS|NC|MC,  DI|NS|NC|MC,  DI|NS|NC|MC, // 0 1 2 3 4 5 6 7
+  DI|NS|NC|MC,  DI|NS|NC|MC,  PU,           PU,           PU,           PU,           PU,           PU, // 8 9 : ; < = > ?
+  PU,           AL|NC|MS|MC,  AL|NC|MS|MC,  AL|NC|MS|MC,  AL|NC|MS|MC,  AL|NC|MS|MC,  AL|NC|MS|MC,  AL|MS|MC, // @ A B C D E F G
+  AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC, // H I J K L M N O
+  AL|NC|MS|MC,  AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC, // P Q R S T U V W
+  AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     PU,           PU,           PU,           PU,           PU|MS|MC, // X Y Z [ \ ] ^ _
+  PU,           AL|NC|MS|MC,  AL|NC|MS|MC,  AL|NC|MS|MC,  AL|NC|MS|MC,  AL|NC|MS|MC,  AL|NC|MS|MC,  AL|MS|MC, // ` a b c d e f g
+  AL|NC|MS|MC,  AL|NC|MS|MC,  AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC, // h i j k l m n o
+  AL|NC|MS|MC,  AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     AL|NC|MS|MC,  AL|MS|MC,     AL|MS|MC, // p q r s t u v w
+  AL|MS|MC,     AL|MS|MC,     AL|MS|MC,     PU,           PU,           PU,           PU,           0, // x y z { | } ~ 7f
+  // 0x80 - 0xff: no class
+};
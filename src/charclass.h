@@ -0,0 +1,26 @@
+#ifndef CHARCLASS_H
+#define CHARCLASS_H
+
+#include <stdbool.h>
+
+// Character classes of the C locale plus the classes the tokenizer needs for
+// names and numeric literals. Non-ASCII bytes have no class.
+enum char_class {
+  CC_SPACE = 1 << 0,
+  CC_ALPHA = 1 << 1,
+  CC_DIGIT = 1 << 2,
+  CC_PUNCT = 1 << 3,
+  CC_NUM_START = 1 << 4,  // First character of a numeric literal
+  CC_NUM = 1 << 5,        // Any further character of a numeric literal
+  CC_NAME_START = 1 << 6, // First character of an identifier or keyword
+  CC_NAME = 1 << 7,       // Any further character of an identifier or keyword
+};
+
+extern const unsigned char char_classes[256];
+
+static inline bool has_class(int c, unsigned char cls)
+{
+  return (char_classes[(unsigned char)c] & cls) != 0;
+}
+
+#endif
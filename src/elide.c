@@ -0,0 +1,246 @@
+#include "elide.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minify.h"
+#include "syntax.h"
+#include "tokenize.h"
+
+// Concrete type of a literal without context, i.e. abstract literals are
+// concretized to i32 or f32
+const char *literal_type(const char *value)
+{
+  size_t len = strlen(value);
+  char last = value[len - 1];
+  bool hex = value[0] == '0' && (value[1] == 'x' || value[1] == 'X');
+  if(last == 'u')
+    return "u32";
+  if(last == 'i')
+    return "i32";
+  if(hex) {
+    // Suffixes of hexadecimal floats follow the exponent, otherwise 'f' is a
+    // digit
+    bool exponent = strpbrk(value, "pP") != NULL;
+    if(exponent && last == 'h')
+      return "f16";
+    return exponent || strchr(value, '.') ? "f32" : "i32";
+  }
+  if(last == 'f')
+    return "f32";
+  if(last == 'h')
+    return "f16";
+  return strpbrk(value, ".eE") ? "f32" : "i32";
+}
+
+bool is_float_literal(const char *value)
+{
+  bool hex = value[0] == '0' && (value[1] == 'x' || value[1] == 'X');
+  return hex ? strpbrk(value, "pP.") != NULL : strpbrk(value, ".eE") != NULL;
+}
+
+bool equal_ranges(const token_node *a, const token_node *a_end,
+    const token_node *b, const token_node *b_end)
+{
+  while(a != a_end && b != b_end) {
+    if(a->type != b->type || strcmp(node_value(a), node_value(b)) != 0)
+      return false;
+    a = next_sig(a);
+    b = next_sig(b);
+  }
+  return a == a_end && b == b_end;
+}
+
+// True if the initializer from init up to the terminating ';' has the type
+// from type up to type_end
+bool has_type(const token_node *init, const token_node *type,
+    const token_node *type_end)
+{
+  // Single, optionally negated literal
+  const token_node *lit = is_sym(init, "-") ? next_sig(init) : init;
+  if(lit && lit->type == LITERAL && is_sym(next_sig(lit), ";"))
+    return next_sig(type) == type_end &&
+      strcmp(literal_type(node_value(lit)), node_value(type)) == 0;
+
+  // Constructor call of the type, e.g. vec3f(...)
+  const token_node *open = init;
+  while(open && open != type_end && !is_sym(open, "(") && !is_sym(open, ";"))
+    open = next_sig(open);
+  if(!is_sym(open, "(") || !equal_ranges(init, open, type, type_end))
+    return false;
+  return is_sym(next_sig(find_close(open, "(", ")")), ";");
+}
+
+// let x: T = init; and var x: T = init; with init of type T
+bool elide_type(token_node **head, token_node *decl)
+{
+  const token_node *name = next_sig(decl);
+  if(is_kw(decl, "var") && is_sym(name, "<"))
+    name = next_sig(find_close(name, "<", ">"));
+  const token_node *colon = next_sig(name);
+  if(!name || name->type != IDENTIFIER || !is_sym(colon, ":"))
+    return false;
+
+  const token_node *type = next_sig(colon);
+  const token_node *eq = skip_type(type);
+  if(!type || type == eq || !is_sym(eq, "=") ||
+      !has_type(next_sig(eq), type, eq))
+    return false;
+
+  splice_nodes(head, (token_node *)colon, (token_node *)prev_sig(eq), NULL);
+  return false;
+}
+
+// var<function> is the default within functions
+bool elide_address_space(token_node **head, token_node *decl)
+{
+  const token_node *open = next_sig(decl);
+  const token_node *space = next_sig(open);
+  const token_node *close = next_sig(space);
+  if(!is_sym(open, "<") || !is_kw(space, "function") || !is_sym(close, ">"))
+    return false;
+
+  // The whitespace separating var from the name is removed again if needless
+  token_node *ws = NULL;
+  if(create_token_node_with_token(&ws, WHITESPACE, " "))
+    return true;
+  splice_nodes(head, (token_node *)open, (token_node *)close, ws);
+  return false;
+}
+
+// @interpolate(perspective) and @interpolate(perspective, center)
+bool elide_interpolate(token_node **head, token_node *at, bool *removed)
+{
+  const token_node *name = next_sig(at);
+  const token_node *open = next_sig(name);
+  const token_node *type = next_sig(open);
+  const token_node *sep = next_sig(type);
+  if(!is_kw(name, "interpolate") || !is_sym(open, "(") ||
+      !is_kw(type, "perspective"))
+    return false;
+
+  const token_node *close = sep;
+  if(is_sym(sep, ",")) {
+    close = next_sig(next_sig(sep));
+    if(!is_kw(next_sig(sep), "center"))
+      return false;
+  }
+  if(!is_sym(close, ")"))
+    return false;
+
+  splice_nodes(head, at, (token_node *)close, NULL);
+  *removed = true;
+  return false;
+}
+
+// Trailing sizes of 1 in @workgroup_size(x, 1, 1)
+bool elide_workgroup_size(token_node **head, token_node *at)
+{
+  const token_node *name = next_sig(at);
+  const token_node *open = next_sig(name);
+  if(!is_kw(name, "workgroup_size") || !is_sym(open, "("))
+    return false;
+
+  const token_node *close = find_close(open, "(", ")");
+  while(close) {
+    const token_node *size = prev_sig(close);
+    const token_node *sep = prev_sig(size);
+    if(!size || size->type != LITERAL || !is_sym(sep, ",") ||
+        (strcmp(node_value(size), "1") != 0 &&
+         strcmp(node_value(size), "1u") != 0 &&
+         strcmp(node_value(size), "1i") != 0))
+      break;
+    splice_nodes(head, (token_node *)sep, (token_node *)size, NULL);
+  }
+  return false;
+}
+
+// Suffix of the scalar type of a constructor like vec3f or mat4x4h, '\0' for
+// other types
+char constructor_suffix(const token_node *node)
+{
+  if(!node || node->type != KEYWORD)
+    return '\0';
+  const char *v = node_value(node);
+  size_t len = strlen(v);
+  if(strcmp(v, "f32") == 0 || strcmp(v, "f16") == 0 ||
+      strcmp(v, "i32") == 0 || strcmp(v, "u32") == 0)
+    return v[0] == 'f' && v[1] == '1' ? 'h' : v[0];
+  if((len == 5 && strncmp(v, "vec", 3) == 0 && v[3] >= '2' && v[3] <= '4') ||
+      (len == 7 && strncmp(v, "mat", 3) == 0 && v[3] >= '2' && v[3] <= '4' &&
+       v[4] == 'x' && v[5] >= '2' && v[5] <= '4'))
+    return strchr("fhiu", v[len - 1]) ? v[len - 1] : '\0';
+  return '\0';
+}
+
+// Literal suffix of a constructor argument of the same scalar type, the
+// abstract literal is converted to it
+bool elide_suffix(token_node *lit)
+{
+  const token_node *prev = prev_sig(lit);
+  const token_node *next = next_sig(lit);
+  if(!(is_sym(prev, "(") || is_sym(prev, ",")) ||
+      !(is_sym(next, ")") || is_sym(next, ",")))
+    return false;
+
+  // Find the opening parenthesis of the argument list
+  int depth = 0;
+  for(; prev; prev = prev_sig(prev)) {
+    if(is_sym(prev, ")"))
+      depth++;
+    else if(is_sym(prev, "(") && depth-- == 0)
+      break;
+  }
+
+  const char *value = node_value(lit);
+  size_t len = strlen(value);
+  char suffix = constructor_suffix(prev_sig(prev));
+  if(len < 2 || !suffix || value[len - 1] != suffix)
+    return false;
+  // Floats must keep their float form, 1f would become an integer
+  if((suffix == 'f' || suffix == 'h') && !is_float_literal(value))
+    return false;
+  if(suffix == 'i' || suffix == 'u') {
+    if(strcmp(literal_type(value), suffix == 'i' ? "i32" : "u32") != 0)
+      return false;
+  } else if(strcmp(literal_type(value), suffix == 'f' ? "f32" : "f16") != 0)
+    return false;
+
+  return set_token_value(lit, value, len - 1);
+}
+
+bool elide_annotations(token_node **head)
+{
+  bool error = false;
+  int depth = 0; // Brace depth, var<function> is only valid within functions
+  token_node *curr = *head;
+  while(!error && curr) {
+    if(is_sym(curr, "{"))
+      depth++;
+    else if(is_sym(curr, "}"))
+      depth--;
+    else if(is_kw(curr, "let"))
+      error = elide_type(head, curr);
+    else if(is_kw(curr, "var"))
+      error = (depth > 0 && elide_address_space(head, curr)) ||
+        elide_type(head, curr);
+    else if(is_sym(curr, "@")) {
+      token_node *prev = curr->prev;
+      bool removed = false;
+      error = elide_workgroup_size(head, curr) ||
+        elide_interpolate(head, curr, &removed);
+      if(removed) {
+        // Continue with the node that followed the removed attribute
+        curr = prev ? prev->next : *head;
+        continue;
+      }
+    } else if(curr->type == LITERAL)
+      error = elide_suffix(curr);
+    curr = curr->next;
+  }
+
+  if(!error)
+    compress_whitespaces(head);
+
+  return error;
+}
@@ -0,0 +1,14 @@
+#ifndef ELIDE_H
+#define ELIDE_H
+
+#include <stdbool.h>
+
+typedef struct token_node token_node;
+
+// Removes syntax that WGSL infers anyway: type annotations of let and var
+// whose initializer has the same type, var<function>, default
+// @interpolate attributes, trailing 1s of @workgroup_size and literal
+// suffixes of constructor arguments.
+bool elide_annotations(token_node **head);
+
+#endif
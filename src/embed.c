@@ -0,0 +1,239 @@
+#include "embed.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "syntax.h"
+#include "tokenize.h"
+
+// Content of a marked template literal
+typedef struct literal_span {
+  size_t start;
+  size_t end;
+  token_node *tokens;
+  struct literal_span *next;
+} literal_span;
+
+typedef struct script_scanner {
+  const char *src;
+  size_t len;
+  size_t marker_end; // Position behind the last wgsl tag or marker comment
+  literal_span *first;
+  literal_span *last;
+  bool error;
+} script_scanner;
+
+bool is_script_name(const char *filename)
+{
+  const char *ext = strrchr(filename, '.');
+  return ext && (strcmp(ext, ".js") == 0 || strcmp(ext, ".mjs") == 0 ||
+      strcmp(ext, ".ts") == 0 || strcmp(ext, ".mts") == 0);
+}
+
+bool is_marker_comment(const char *comment, size_t len)
+{
+  // Strip "/*" and "*/" and surrounding whitespace
+  size_t i = 2, end = len > 4 ? len - 2 : 2;
+  while(i < end && (comment[i] == ' ' || comment[i] == '\t'))
+    i++;
+  while(end > i && (comment[end - 1] == ' ' || comment[end - 1] == '\t'))
+    end--;
+  return end - i == 4 && memcmp(comment + i, "wgsl", 4) == 0;
+}
+
+bool is_marked(const script_scanner *s, size_t backtick)
+{
+  while(backtick > 0 && strchr(" \t\r\n", s->src[backtick - 1]))
+    backtick--;
+  return s->marker_end > 0 && backtick == s->marker_end;
+}
+
+void add_span(script_scanner *s, size_t start, size_t end)
+{
+  literal_span *span = malloc(sizeof(*span));
+  if(!span) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    s->error = true;
+    return;
+  }
+  span->start = start;
+  span->end = end;
+  span->tokens = NULL;
+  span->next = NULL;
+  if(s->last)
+    s->last->next = span;
+  else
+    s->first = span;
+  s->last = span;
+}
+
+size_t scan_script(script_scanner *s, size_t pos, bool in_substitution,
+    bool in_marked);
+
+// Scans a template literal starting behind the opening backtick
+size_t scan_template(script_scanner *s, size_t pos, bool marked,
+    bool in_marked)
+{
+  size_t start = pos;
+  while(pos < s->len && s->src[pos] != '`') {
+    if(s->src[pos] == '\\')
+      pos += 2;
+    else if(s->src[pos] == '$' && pos + 1 < s->len && s->src[pos + 1] == '{')
+      pos = scan_script(s, pos + 2, true, in_marked || marked);
+    else
+      pos++;
+  }
+
+  size_t end = pos < s->len ? pos : s->len;
+  if(marked && !in_marked)
+    add_span(s, start, end);
+
+  return pos + 1;
+}
+
+// Scans JavaScript code up to the end of the source or the '}' closing the
+// current substitution. Regular expression literals are not recognized.
+size_t scan_script(script_scanner *s, size_t pos, bool in_substitution,
+    bool in_marked)
+{
+  size_t depth = 0;
+  while(!s->error && pos < s->len) {
+    char c = s->src[pos];
+    char next = pos + 1 < s->len ? s->src[pos + 1] : '\0';
+    if(c == '\'' || c == '"') {
+      pos++;
+      while(pos < s->len && s->src[pos] != c && s->src[pos] != '\n')
+        pos += s->src[pos] == '\\' ? 2 : 1;
+      pos++;
+    } else if(c == '/' && next == '/') {
+      while(pos < s->len && s->src[pos] != '\n')
+        pos++;
+    } else if(c == '/' && next == '*') {
+      size_t comment_end = pos + 2;
+      while(comment_end + 1 < s->len && !(s->src[comment_end] == '*' &&
+            s->src[comment_end + 1] == '/'))
+        comment_end++;
+      comment_end = comment_end + 1 < s->len ? comment_end + 2 : s->len;
+      if(is_marker_comment(s->src + pos, comment_end - pos))
+        s->marker_end = comment_end;
+      pos = comment_end;
+    } else if(c == '`') {
+      bool marked = is_marked(s, pos);
+      pos = scan_template(s, pos + 1, marked, in_marked);
+    } else if(c == '{') {
+      depth++;
+      pos++;
+    } else if(c == '}') {
+      pos++;
+      if(depth == 0 && in_substitution)
+        return pos;
+      depth -= depth > 0;
+    } else if(is_name(c, 0)) {
+      size_t start = pos;
+      while(pos < s->len && is_name(s->src[pos], pos - start))
+        pos++;
+      if(pos - start == 4 && memcmp(s->src + start, "wgsl", 4) == 0)
+        s->marker_end = pos;
+    } else
+      pos++;
+  }
+
+  return pos;
+}
+
+void free_spans(literal_span *first)
+{
+  while(first) {
+    literal_span *next = first->next;
+    free_token_nodes(first->tokens);
+    free(first);
+    first = next;
+  }
+}
+
+bool minify_span(const char *src, literal_span *span,
+    const embed_options *options)
+{
+  bool error = tokenize_str(src + span->start, span->end - span->start,
+      &span->tokens);
+  if(!error)
+    error = preprocess(&span->tokens, options->defines);
+  if(!error)
+    error = minify(&span->tokens);
+  return error;
+}
+
+// Links the token lists of all spans separated by an empty SUBSTITUTION token
+// so that they are mangled together.
+bool join_spans(literal_span *first, token_node **head)
+{
+  token_node *last = NULL;
+  for(literal_span *span = first; span; span = span->next) {
+    if(create_token_node_with_token(&last, SUBSTITUTION, ""))
+      return true;
+    if(!*head)
+      *head = last;
+    if(span->tokens) {
+      last->next = span->tokens;
+      span->tokens->prev = last;
+      while(last->next)
+        last = last->next;
+      span->tokens = NULL;
+    }
+  }
+  return false;
+}
+
+bool render_embedded(const char *src, size_t len, const literal_span *spans,
+    const token_node *head, char **output)
+{
+  buffer buf = { NULL, 0, 0 };
+  bool error = false;
+  size_t pos = 0;
+  for(const literal_span *span = spans; !error && span; span = span->next) {
+    error = write_buf_mem(&buf, src + pos, span->start - pos);
+    // Skip the separator and write the tokens up to the next one
+    head = head->next;
+    for(; !error && head && !(head->type == SUBSTITUTION &&
+          *((token *)head->token)->value == '\0'); head = head->next)
+      error = write_buf_str(&buf, node_value(head));
+    pos = span->end;
+  }
+  if(!error)
+    error = write_buf_mem(&buf, src + pos, len - pos);
+
+  if(error) {
+    free(buf.ptr);
+    return true;
+  }
+  *output = buf_to_str(&buf, true);
+
+  return !*output;
+}
+
+bool minify_embedded(const char *src, size_t len, const embed_options *options,
+    char **output)
+{
+  script_scanner s = { src, len, 0, NULL, NULL, false };
+  scan_script(&s, 0, false, false);
+
+  bool error = s.error;
+  for(literal_span *span = s.first; !error && span; span = span->next)
+    error = minify_span(src, span, options);
+
+  token_node *head = NULL;
+  mangled_names names = { NULL, 0 };
+  if(!error)
+    error = join_spans(s.first, &head);
+  if(!error && options->mangle)
+    error = mangle(&head, options->mangle, &names);
+  if(!error)
+    error = render_embedded(src, len, s.first, head, output);
+
+  free_token_nodes(head);
+  free_mangled_names(&names);
+  free_spans(s.first);
+
+  return error;
+}
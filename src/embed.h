@@ -0,0 +1,24 @@
+#ifndef EMBED_H
+#define EMBED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "minify.h"
+#include "preprocess.h"
+
+typedef struct embed_options {
+  const mangle_options *mangle; // NULL to skip mangling
+  const define *defines;
+} embed_options;
+
+// True for file names ending in .js, .mjs, .ts or .mts
+bool is_script_name(const char *filename);
+
+// Minifies the WGSL template literals of JavaScript/TypeScript source that
+// are tagged (wgsl`...`) or marked by a preceding /* wgsl */ comment and
+// returns the rewritten source. All literals of the source are mangled
+// together, so names may be shared via ${...} substitutions.
+bool minify_embedded(const char *src, size_t len, const embed_options *options,
+    char **output);
+
+#endif
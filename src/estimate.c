@@ -0,0 +1,145 @@
+#include "estimate.h"
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_SIZE 32768
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_CHAIN 64
+
+#define LITLEN_CODES 286
+#define DIST_CODES 30
+
+const uint16_t length_base[] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t length_extra[] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t dist_base[] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+  16385, 24577 };
+const uint8_t dist_extra[] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+size_t find_code(const uint16_t *base, size_t count, size_t value)
+{
+  size_t i = count - 1;
+  while(i > 0 && base[i] > value)
+    i--;
+  return i;
+}
+
+uint32_t hash3(const unsigned char *p)
+{
+  return ((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]) * 2654435761u >>
+    (32 - HASH_BITS);
+}
+
+double entropy_bits(const size_t *freq, size_t count, size_t *used)
+{
+  size_t total = 0;
+  for(size_t i=0; i<count; i++)
+    total += freq[i];
+
+  double bits = 0.0;
+  *used = 0;
+  for(size_t i=0; i<count; i++) {
+    if(freq[i] > 0) {
+      // Huffman codes are at least one bit long
+      double len = -log2((double)freq[i] / total);
+      bits += freq[i] * (len < 1.0 ? 1.0 : len);
+      (*used)++;
+    }
+  }
+
+  return bits;
+}
+
+size_t estimate_compressed_size(const char *data, size_t len)
+{
+  const unsigned char *src = (const unsigned char *)data;
+  size_t litlen_freq[LITLEN_CODES] = { 0 };
+  size_t dist_freq[DIST_CODES] = { 0 };
+  size_t extra_bits = 0;
+
+  int32_t *head = malloc(HASH_SIZE * sizeof(*head));
+  int32_t *prev = malloc(WINDOW_SIZE * sizeof(*prev));
+  if(!head || !prev) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(head);
+    free(prev);
+    return len;
+  }
+
+  for(size_t i=0; i<HASH_SIZE; i++)
+    head[i] = -1;
+
+  size_t pos = 0;
+  while(pos < len) {
+    size_t best_len = 0, best_dist = 0;
+
+    if(pos + MIN_MATCH <= len) {
+      uint32_t h = hash3(src + pos);
+      int32_t cand = head[h];
+      size_t max_len = len - pos < MAX_MATCH ? len - pos : MAX_MATCH;
+      for(size_t chain=0; cand >= 0 && chain < MAX_CHAIN &&
+          pos - (size_t)cand <= WINDOW_SIZE; chain++) {
+        size_t l = 0;
+        while(l < max_len && src[cand + l] == src[pos + l])
+          l++;
+        if(l > best_len) {
+          best_len = l;
+          best_dist = pos - cand;
+          if(l == max_len)
+            break;
+        }
+        int32_t next = prev[cand % WINDOW_SIZE];
+        if(next >= cand)
+          break;
+        cand = next;
+      }
+    }
+
+    size_t step = 1;
+    if(best_len >= MIN_MATCH) {
+      size_t lc = find_code(length_base, sizeof(length_base) / sizeof(length_base[0]), best_len);
+      size_t dc = find_code(dist_base, DIST_CODES, best_dist);
+      litlen_freq[257 + lc]++;
+      dist_freq[dc]++;
+      extra_bits += length_extra[lc] + dist_extra[dc];
+      step = best_len;
+    } else
+      litlen_freq[src[pos]]++;
+
+    for(size_t i=0; i<step; i++, pos++) {
+      if(pos + MIN_MATCH <= len) {
+        uint32_t h = hash3(src + pos);
+        prev[pos % WINDOW_SIZE] = head[h];
+        head[h] = (int32_t)pos;
+      }
+    }
+  }
+
+  litlen_freq[256]++; // End of block
+
+  free(head);
+  free(prev);
+
+  size_t litlen_used, dist_used;
+  double bits = entropy_bits(litlen_freq, LITLEN_CODES, &litlen_used) +
+    entropy_bits(dist_freq, DIST_CODES, &dist_used) + extra_bits;
+
+  // Block header with the code length tables of a dynamic Huffman block
+  bits += 17 + 4 * (litlen_used + dist_used);
+
+  return (size_t)ceil(bits / 8.0);
+}
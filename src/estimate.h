@@ -0,0 +1,11 @@
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include <stddef.h>
+
+// Estimates the size in bytes of the given data after deflate compression
+// (as used by gzip and, approximately, brotli). Runs an LZ77 pass over a
+// 32k window and prices the resulting symbols by their entropy.
+size_t estimate_compressed_size(const char *data, size_t len);
+
+#endif
@@ -0,0 +1,208 @@
+#include "exclude.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "tokenize.h"
+#include "unicode.h"
+
+size_t hash_exclude_name(const char *name, size_t len)
+{
+  size_t h = 14695981039346656037u;
+  for(size_t i=0; i<len; i++)
+    h = (h ^ (unsigned char)name[i]) * 1099511628211u;
+  return h;
+}
+
+char **find_exclude_slot(const exclude_set *set, const char *name, size_t len)
+{
+  size_t mask = set->slot_count - 1;
+  size_t i = hash_exclude_name(name, len) & mask;
+  while(set->slots[i] && (strncmp(set->slots[i], name, len) != 0 ||
+        set->slots[i][len] != '\0'))
+    i = (i + 1) & mask;
+  return &set->slots[i];
+}
+
+bool grow_exclude_set(exclude_set *set)
+{
+  size_t slot_count = set->slot_count ? 2 * set->slot_count : 64;
+  char **slots = calloc(slot_count, sizeof(*slots));
+  if(!slots) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+
+  exclude_set grown = *set;
+  grown.slots = slots;
+  grown.slot_count = slot_count;
+  for(size_t i=0; i<set->slot_count; i++)
+    if(set->slots[i])
+      *find_exclude_slot(&grown, set->slots[i], strlen(set->slots[i])) =
+        set->slots[i];
+  free(set->slots);
+  set->slots = slots;
+  set->slot_count = slot_count;
+
+  return false;
+}
+
+bool add_pattern(exclude_set *set, char *pattern)
+{
+  char **patterns = realloc(set->patterns,
+      (set->pattern_count + 1) * sizeof(*patterns));
+  if(!patterns) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  set->patterns = patterns;
+  set->patterns[set->pattern_count++] = pattern;
+  return false;
+}
+
+bool add_exclude(exclude_set *set, const char *name, size_t len)
+{
+  bool pattern = false;
+  for(size_t i=0; i<len; i++) {
+    if(name[i] == '*' || name[i] == '?')
+      pattern = true;
+    else if(!is_name(name[i], i)) {
+      uint32_t cp;
+      size_t n = decode_utf8(name, len, i, &cp);
+      if(n == 0 || !(i == 0 ? is_xid_start(cp) : is_xid_continue(cp))) {
+        fprintf(stderr, "Illegal character '%c' in excluded identifier '%.*s'\n",
+            name[i], (int)len, name);
+        return true;
+      }
+      i += n - 1;
+    }
+  }
+
+  if(!pattern && 2 * (set->count + 1) > set->slot_count &&
+      grow_exclude_set(set))
+    return true;
+
+  char **slot = pattern ? NULL : find_exclude_slot(set, name, len);
+  if(slot && *slot)
+    return false;
+
+  char *copy = strndup(name, len);
+  if(!copy) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+
+  if(pattern) {
+    if(add_pattern(set, copy)) {
+      free(copy);
+      return true;
+    }
+  } else {
+    *slot = copy;
+    set->count++;
+  }
+
+  return false;
+}
+
+bool add_exclude_list(exclude_set *set, const char *list)
+{
+  bool error = false;
+  while(!error && *list) {
+    size_t len = strcspn(list, ",");
+    if(len > 0)
+      error = add_exclude(set, list, len);
+    list += len + (list[len] == ',');
+  }
+  return error;
+}
+
+bool read_exclude_file(exclude_set *set, const char *filename)
+{
+  FILE *file = fopen(filename, "rt");
+  if(!file) {
+    fprintf(stderr, "Failed to open '%s': %s\n", filename, strerror(errno));
+    return true;
+  }
+
+  char *src;
+  size_t len;
+  bool error = read_file(file, &src, &len);
+  fclose(file);
+  if(error)
+    return true;
+
+  const char *separators = ", \t\r\n";
+  for(size_t pos = 0; !error && pos < len;) {
+    if(src[pos] == '#')
+      pos += strcspn(src + pos, "\n");
+    else if(strchr(separators, src[pos]))
+      pos++;
+    else {
+      size_t n = strcspn(src + pos, ", \t\r\n#");
+      error = add_exclude(set, src + pos, n);
+      pos += n;
+    }
+  }
+  free_source(src, len);
+
+  return error;
+}
+
+// Matches '*' against any, '?' against a single character
+bool match_pattern(const char *pattern, const char *name)
+{
+  const char *star = NULL, *retry = NULL;
+  while(*name) {
+    if(*pattern == '*') {
+      star = pattern++;
+      retry = name;
+    } else if(*pattern == '?') {
+      // Skip the continuation bytes of a UTF-8 sequence
+      pattern++;
+      name++;
+      while((*name & 0xc0) == 0x80)
+        name++;
+    } else if(*pattern == *name) {
+      pattern++;
+      name++;
+    } else if(star) {
+      // Let the last '*' consume one more character
+      pattern = star + 1;
+      name = ++retry;
+    } else
+      return false;
+  }
+  while(*pattern == '*')
+    pattern++;
+  return *pattern == '\0';
+}
+
+bool is_excluded(const char *name, const exclude_set *set)
+{
+  if(!set)
+    return false;
+  if(set->count > 0 && *find_exclude_slot(set, name, strlen(name)))
+    return true;
+  for(size_t i=0; i<set->pattern_count; i++)
+    if(match_pattern(set->patterns[i], name))
+      return true;
+  return false;
+}
+
+bool has_excludes(const exclude_set *set)
+{
+  return set->count > 0 || set->pattern_count > 0;
+}
+
+void free_exclude_set(exclude_set *set)
+{
+  for(size_t i=0; i<set->slot_count; i++)
+    free(set->slots[i]);
+  free(set->slots);
+  for(size_t i=0; i<set->pattern_count; i++)
+    free(set->patterns[i]);
+  free(set->patterns);
+  *set = (exclude_set){ NULL, 0, 0, NULL, 0 };
+}
@@ -0,0 +1,28 @@
+#ifndef EXCLUDE_H
+#define EXCLUDE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Names excluded from mangling and inlining. Plain names are kept in a hash
+// set, patterns containing '*' (any characters) or '?' (one character) are
+// matched one after the other. Zero initialize before use.
+typedef struct exclude_set {
+  char **slots; // Plain names, open addressing
+  size_t slot_count;
+  size_t count;
+  char **patterns;
+  size_t pattern_count;
+} exclude_set;
+
+bool add_exclude(exclude_set *set, const char *name, size_t len);
+// Adds the names of a comma separated list
+bool add_exclude_list(exclude_set *set, const char *list);
+// Adds the names of a file separated by commas or whitespace, '#' starts a
+// comment up to the end of the line
+bool read_exclude_file(exclude_set *set, const char *filename);
+bool is_excluded(const char *name, const exclude_set *set);
+bool has_excludes(const exclude_set *set);
+void free_exclude_set(exclude_set *set);
+
+#endif
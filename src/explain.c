@@ -0,0 +1,297 @@
+#include "explain.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "syntax.h"
+
+#define TOP_IDENTIFIERS 20
+
+const char *token_type_names[] = { "comment", "keyword", "identifier",
+  "literal", "symbol", "whitespace", "substitution", "directive" };
+
+size_t span_size(const token_node *first, const token_node *last)
+{
+  size_t size = 0;
+  for(const token_node *curr = first; curr != last->next; curr = curr->next)
+    size += strlen(node_value(curr));
+  return size;
+}
+
+// Raw tokens span their source text, whitespace runs have a shorter value
+size_t span_length(const token_node *first, const token_node *last)
+{
+  size_t length = 0;
+  for(const token_node *curr = first; curr != last->next; curr = curr->next)
+    length += curr->length;
+  return length;
+}
+
+bool equal_names(const char *a, const char *b)
+{
+  return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+bool find_declaration_size(size_report *report, const token_node *first,
+    const token_node *last, declaration_size **decl)
+{
+  const token_node *keyword, *name;
+  find_declaration_name(first, last, &keyword, &name);
+  const char *kw = keyword ? node_value(keyword) : NULL;
+  const char *n = name ? node_value(name) : NULL;
+
+  declaration_size **tail = &report->first;
+  for(; *tail; tail = &(*tail)->next) {
+    if(equal_names((*tail)->keyword, kw) && equal_names((*tail)->name, n)) {
+      *decl = *tail;
+      return false;
+    }
+  }
+
+  *decl = calloc(1, sizeof(**decl));
+  if(*decl) {
+    (*decl)->keyword = kw ? strdup(kw) : NULL;
+    (*decl)->name = n ? strdup(n) : NULL;
+  }
+  if(!*decl || (kw && !(*decl)->keyword) || (n && !(*decl)->name)) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    if(*decl) {
+      free((*decl)->keyword);
+      free(*decl);
+    }
+    return true;
+  }
+  *tail = *decl;
+
+  return false;
+}
+
+bool explain_input(const token_node *head, size_report *report)
+{
+  for(const token_node *curr = head; curr; curr = curr->next)
+    report->input[curr->type] += curr->length;
+
+  bool error = false;
+  for(const token_node *first = head; !error && first;) {
+    const token_node *last = declaration_end(first);
+    declaration_size *decl;
+    error = find_declaration_size(report, first, last, &decl);
+    if(!error)
+      decl->input += span_length(first, last);
+    first = last->next;
+  }
+
+  return error;
+}
+
+bool explain_names(const token_node *head, size_report *report)
+{
+  size_t spans = 0, names = 0;
+  for(const token_node *first = head; first; first = declaration_end(first)->next)
+    spans++;
+  for(const token_node *curr = head; curr; curr = curr->next)
+    names += curr->type == IDENTIFIER;
+
+  report->outputs = calloc(spans ? spans : 1, sizeof(*report->outputs));
+  report->names = calloc(names ? names : 1, sizeof(*report->names));
+  if(!report->outputs || !report->names) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+
+  bool error = false;
+  for(const token_node *first = head; !error && first;) {
+    const token_node *last = declaration_end(first);
+    error = find_declaration_size(report, first, last,
+        &report->outputs[report->output_count++]);
+    first = last->next;
+  }
+
+  for(const token_node *curr = head; !error && curr; curr = curr->next) {
+    if(curr->type == IDENTIFIER) {
+      report->names[report->name_count] = strdup(node_value(curr));
+      error = !report->names[report->name_count++];
+      if(error)
+        fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    }
+  }
+
+  return error;
+}
+
+int compare_identifier_names(const void *a, const void *b)
+{
+  return strcmp(((const identifier_size *)a)->name,
+      ((const identifier_size *)b)->name);
+}
+
+int compare_identifier_sizes(const void *a, const void *b)
+{
+  const identifier_size *x = a, *y = b;
+  return (x->output < y->output) - (x->output > y->output);
+}
+
+int compare_declaration_sizes(const void *a, const void *b)
+{
+  const declaration_size *x = *(declaration_size * const *)a;
+  const declaration_size *y = *(declaration_size * const *)b;
+  if(x->output != y->output)
+    return (x->output < y->output) - (x->output > y->output);
+  return (x->input < y->input) - (x->input > y->input);
+}
+
+// Pairs the recorded names with the final identifier tokens and sums them up
+// per name
+bool explain_identifiers(const token_node *head, size_report *report)
+{
+  identifier_size *ids = calloc(report->name_count ? report->name_count : 1,
+      sizeof(*ids));
+  if(!ids) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+
+  size_t count = 0;
+  for(const token_node *curr = head; curr && count < report->name_count;
+      curr = curr->next) {
+    if(curr->type == IDENTIFIER) {
+      const char *name = report->names[count];
+      ids[count++] = (identifier_size){ (char *)name, (char *)node_value(curr),
+        1, strlen(name), strlen(node_value(curr)) };
+    }
+  }
+
+  qsort(ids, count, sizeof(*ids), compare_identifier_names);
+  size_t unique = 0;
+  for(size_t i=0; i<count; i++) {
+    identifier_size *prev = unique > 0 ? &ids[unique - 1] : NULL;
+    if(prev && strcmp(prev->name, ids[i].name) == 0) {
+      prev->mangled = ids[i].mangled;
+      prev->count++;
+      prev->input += ids[i].input;
+      prev->output += ids[i].output;
+    } else
+      ids[unique++] = ids[i];
+  }
+
+  // Copy the mangled names, the tokens do not outlive the report
+  bool error = false;
+  for(size_t i=0; i<unique; i++) {
+    ids[i].mangled = error ? NULL : strdup(ids[i].mangled);
+    if(!error && !ids[i].mangled) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      error = true;
+    }
+  }
+  qsort(ids, unique, sizeof(*ids), compare_identifier_sizes);
+  report->identifiers = ids;
+  report->identifier_count = unique;
+
+  return error;
+}
+
+bool explain_output(const token_node *head, size_report *report)
+{
+  for(const token_node *curr = head; curr; curr = curr->next)
+    report->output[curr->type] += strlen(node_value(curr));
+
+  size_t index = 0;
+  for(const token_node *first = head; first; index++) {
+    const token_node *last = declaration_end(first);
+    if(index >= report->output_count) {
+      fprintf(stderr, "Declarations changed after recording names\n");
+      return true;
+    }
+
+    declaration_size *decl = report->outputs[index];
+    decl->output += span_size(first, last);
+    const token_node *keyword, *name;
+    find_declaration_name(first, last, &keyword, &name);
+    if(decl->name && name && strcmp(decl->name, node_value(name)) != 0) {
+      free(decl->mangled);
+      decl->mangled = strdup(node_value(name));
+      if(!decl->mangled) {
+        fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+        return true;
+      }
+    }
+    first = last->next;
+  }
+
+  return explain_identifiers(head, report);
+}
+
+void print_size_report(FILE *file, const size_report *report)
+{
+  size_t input = 0, output = 0;
+  fprintf(file, "%-40s %10s %10s\n", "Bytes by token type", "input", "output");
+  for(size_t i=0; i<=DIRECTIVE; i++) {
+    if(report->input[i] > 0 || report->output[i] > 0)
+      fprintf(file, "  %-38s %10zu %10zu\n", token_type_names[i],
+          report->input[i], report->output[i]);
+    input += report->input[i];
+    output += report->output[i];
+  }
+  fprintf(file, "  %-38s %10zu %10zu\n", "total", input, output);
+
+  size_t count = 0;
+  for(const declaration_size *decl = report->first; decl; decl = decl->next)
+    count++;
+  declaration_size **sorted = malloc((count ? count : 1) * sizeof(*sorted));
+  if(sorted) {
+    count = 0;
+    for(declaration_size *decl = report->first; decl; decl = decl->next)
+      sorted[count++] = decl;
+    qsort(sorted, count, sizeof(*sorted), compare_declaration_sizes);
+
+    fprintf(file, "\n%-40s %10s %10s\n", "Bytes by declaration", "input",
+        "output");
+    for(size_t i=0; i<count; i++) {
+      const declaration_size *decl = sorted[i];
+      char label[39];
+      if(!decl->keyword)
+        snprintf(label, sizeof(label), "(other)");
+      else
+        snprintf(label, sizeof(label), "%s%s%s%s%s", decl->keyword,
+            decl->name ? " " : "", decl->name ? decl->name : "",
+            decl->mangled ? " -> " : "", decl->mangled ? decl->mangled : "");
+      fprintf(file, "  %-38s %10zu %10zu\n", label, decl->input, decl->output);
+    }
+    free(sorted);
+  } else
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+
+  fprintf(file, "\n%-29s %10s %10s %10s\n", "Top identifiers by output bytes",
+      "count", "input", "output");
+  for(size_t i=0; i<report->identifier_count && i<TOP_IDENTIFIERS; i++) {
+    const identifier_size *id = &report->identifiers[i];
+    char label[28];
+    if(id->mangled && strcmp(id->name, id->mangled) != 0)
+      snprintf(label, sizeof(label), "%s -> %s", id->name, id->mangled);
+    else
+      snprintf(label, sizeof(label), "%s", id->name);
+    fprintf(file, "  %-27s %10zu %10zu %10zu\n", label, id->count, id->input,
+        id->output);
+  }
+}
+
+void free_size_report(size_report *report)
+{
+  while(report->first) {
+    declaration_size *next = report->first->next;
+    free(report->first->keyword);
+    free(report->first->name);
+    free(report->first->mangled);
+    free(report->first);
+    report->first = next;
+  }
+  free(report->outputs);
+  // Identifier names are owned by the recorded names
+  for(size_t i=0; i<report->identifier_count; i++)
+    free(report->identifiers[i].mangled);
+  free(report->identifiers);
+  for(size_t i=0; i<report->name_count; i++)
+    free(report->names[i]);
+  free(report->names);
+  *report = (size_report){ { 0 }, { 0 }, NULL, NULL, 0, NULL, 0, NULL, 0 };
+}
@@ -0,0 +1,51 @@
+#ifndef EXPLAIN_H
+#define EXPLAIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "tokenize.h"
+
+// Bytes of a module scope declaration, declarations are identified by their
+// keyword and name. Directives and stray tokens have no name, tokens outside
+// of any declaration have no keyword either.
+typedef struct declaration_size {
+  char *keyword;
+  char *name;
+  char *mangled;
+  size_t input;
+  size_t output;
+  struct declaration_size *next;
+} declaration_size;
+
+typedef struct identifier_size {
+  char *name;
+  char *mangled; // Last name assigned, members may be named per struct
+  size_t count;
+  size_t input;
+  size_t output;
+} identifier_size;
+
+// Attribution of input and output bytes to token types and declarations.
+// Zero initialize before use. Input is recorded from the raw tokens, names
+// before mangling and output from the final tokens, which have to be the same
+// tokens as the recorded names apart from their values.
+typedef struct size_report {
+  size_t input[DIRECTIVE + 1];
+  size_t output[DIRECTIVE + 1];
+  declaration_size *first;
+  declaration_size **outputs; // Declaration of each final declaration span
+  size_t output_count;
+  char **names;               // Name of each identifier token before mangling
+  size_t name_count;
+  identifier_size *identifiers; // Sorted by output bytes
+  size_t identifier_count;
+} size_report;
+
+bool explain_input(const token_node *head, size_report *report);
+bool explain_names(const token_node *head, size_report *report);
+bool explain_output(const token_node *head, size_report *report);
+void print_size_report(FILE *file, const size_report *report);
+void free_size_report(size_report *report);
+
+#endif
@@ -0,0 +1,215 @@
+#include "incremental.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "inline.h"
+#include "tokenize.h"
+#include "unicode.h"
+
+// Tokens are determined by the source from their start up to their end plus
+// at most this many bytes of lookahead. Symbols look at up to 3 bytes, names
+// decode the UTF-8 sequence following them.
+#define MAX_LOOKAHEAD (MAX_UTF8_LENGTH > 3 ? MAX_UTF8_LENGTH : 3)
+
+bool incremental_edit(incremental_state *state, size_t offset, size_t removed,
+    const char *text, size_t text_len)
+{
+  if(offset > state->len || removed > state->len - offset) {
+    fprintf(stderr, "Edit out of range: %zu+%zu of %zu bytes\n", offset,
+        removed, state->len);
+    return true;
+  }
+
+  size_t len = state->len - removed + text_len;
+  char *src = malloc(len + 1);
+  if(!src) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  if(state->src) {
+    memcpy(src, state->src, offset);
+    memcpy(src + offset + text_len, state->src + offset + removed,
+        state->len - offset - removed);
+  }
+  memcpy(src + offset, text, text_len);
+  src[len] = '\0';
+
+  // Restart at the first token that may be affected by the change. Positions
+  // without token were skipped one byte at a time and are safe to restart at.
+  size_t restart = offset > MAX_LOOKAHEAD ? offset - MAX_LOOKAHEAD : 0;
+  token_node *first = state->tokens;
+  while(first && first->offset + first->length <= restart)
+    first = first->next;
+  size_t pos = first && first->offset < restart ? first->offset : restart;
+
+  // Tokenize until a new token starts where an old token started behind the
+  // change, everything from there on is unchanged except for its offset.
+  size_t old_end = offset + removed, new_end = offset + text_len;
+  token_node *sync = first, *last = NULL, *head = NULL;
+  bool error = false;
+  while(!error && pos < len) {
+    if(pos >= new_end) {
+      size_t old_pos = pos - new_end + old_end;
+      while(sync && sync->offset < old_pos)
+        sync = sync->next;
+      if(sync && sync->offset == old_pos)
+        break;
+    }
+    error = tokenize_next(src, len, &pos, &last);
+    if(!error && !head)
+      head = last;
+  }
+  if(pos >= len)
+    sync = NULL;
+
+  if(error) {
+    free_token_nodes(head);
+    free(src);
+    return true;
+  }
+
+  // Replace the tokens from first up to sync by the new ones
+  token_node *prev = first ? first->prev : NULL;
+  if(!first) {
+    prev = state->tokens;
+    while(prev && prev->next)
+      prev = prev->next;
+  }
+  while(first && first != sync) {
+    token_node *next = first->next;
+    free_token_node(first);
+    first = next;
+  }
+
+  if(!head) {
+    head = sync;
+    last = prev;
+  }
+  if(prev)
+    prev->next = head;
+  else
+    state->tokens = head;
+  if(head)
+    head->prev = prev;
+  if(last && last != prev)
+    last->next = sync;
+  if(sync)
+    sync->prev = last;
+
+  for(token_node *curr = sync; curr; curr = curr->next)
+    curr->offset = curr->offset - old_end + new_end;
+
+  free(state->src);
+  state->src = src;
+  state->len = len;
+
+  return false;
+}
+
+bool incremental_update(incremental_state *state, const char *src, size_t len)
+{
+  size_t prefix = 0;
+  while(prefix < len && prefix < state->len && src[prefix] == state->src[prefix])
+    prefix++;
+
+  size_t suffix = 0;
+  while(suffix < len - prefix && suffix < state->len - prefix &&
+      src[len - suffix - 1] == state->src[state->len - suffix - 1])
+    suffix++;
+
+  return incremental_edit(state, prefix, state->len - prefix - suffix,
+      src + prefix, len - prefix - suffix);
+}
+
+bool incremental_minify(incremental_state *state,
+    const incremental_options *options, char **output)
+{
+  token_node *head = NULL;
+  mangled_names names = { NULL, 0 };
+  bool error = copy_token_nodes(state->tokens, &head);
+  if(!error)
+    error = preprocess(&head, options->defines);
+  if(!error)
+    error = minify(&head);
+  if(!error && options->inline_functions) {
+    const mangle_options *m = options->mangle;
+    error = inline_functions(&head, m ? m->excludes : NULL,
+        options->inline_threshold);
+  }
+  if(!error && options->mangle) {
+    mangle_options mangle_opts = *options->mangle;
+    mangle_opts.cache = &state->cache;
+    error = mangle(&head, &mangle_opts, &names);
+  }
+  if(!error) {
+    *output = tokens_to_str(head);
+    error = !*output;
+  }
+  free_token_nodes(head);
+  free_mangled_names(&names);
+
+  return error;
+}
+
+void free_incremental_state(incremental_state *state)
+{
+  free(state->src);
+  free_token_nodes(state->tokens);
+  free_mangle_cache(&state->cache);
+  state->src = NULL;
+  state->len = 0;
+  state->tokens = NULL;
+}
+
+bool serve_incremental(FILE *in, FILE *out, const incremental_options *options)
+{
+  incremental_state state = { NULL, 0, NULL, { NULL, NULL, NULL, 0 } };
+  char line[128];
+  bool error = false;
+
+  while(!error && fgets(line, sizeof(line), in)) {
+    size_t offset = 0, removed = 0, len = 0;
+    bool edit = sscanf(line, "edit %zu %zu %zu", &offset, &removed, &len) == 3;
+    if(!edit && sscanf(line, "text %zu", &len) != 1) {
+      fprintf(stderr, "Illegal request: %s", line);
+      error = true;
+      break;
+    }
+
+    char *text = malloc(len + 1);
+    if(!text) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      error = true;
+      break;
+    }
+    if(fread(text, 1, len, in) != len) {
+      fprintf(stderr, "Failed to read request: %s\n",
+          feof(in) ? "unexpected end of file" : strerror(errno));
+      free(text);
+      error = true;
+      break;
+    }
+    text[len] = '\0';
+
+    char *output = NULL;
+    bool failed = edit ? incremental_edit(&state, offset, removed, text, len) :
+      incremental_update(&state, text, len);
+    if(!failed)
+      failed = incremental_minify(&state, options, &output);
+    free(text);
+
+    if(failed)
+      fprintf(out, "error\n");
+    else {
+      fprintf(out, "%zu\n", strlen(output));
+      fwrite(output, 1, strlen(output), out);
+    }
+    fflush(out);
+    free(output);
+  }
+
+  free_incremental_state(&state);
+
+  return error;
+}
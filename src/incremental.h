@@ -0,0 +1,45 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "minify.h"
+#include "preprocess.h"
+
+typedef struct token_node token_node;
+
+// Source text and raw token stream of the previous update together with the
+// name assignment of the previous mangle run. Zero initialize before use.
+typedef struct incremental_state {
+  char *src;
+  size_t len;
+  token_node *tokens;
+  mangle_cache cache;
+} incremental_state;
+
+typedef struct incremental_options {
+  mangle_options *mangle; // NULL to skip mangling
+  bool inline_functions;
+  size_t inline_threshold;
+  const define *defines;
+} incremental_options;
+
+// Replaces removed bytes at offset by the given text and retokenizes only the
+// region affected by the change.
+bool incremental_edit(incremental_state *state, size_t offset, size_t removed,
+    const char *text, size_t text_len);
+// Replaces the whole source text, the changed byte range is derived from the
+// common prefix and suffix with the previous text.
+bool incremental_update(incremental_state *state, const char *src, size_t len);
+bool incremental_minify(incremental_state *state,
+    const incremental_options *options, char **output);
+void free_incremental_state(incremental_state *state);
+
+// Reads requests from in until end of file and replies with the minified
+// output of each. A request is either "text <len>\n" or
+// "edit <offset> <removed> <len>\n" followed by len bytes. A reply is
+// "<len>\n" followed by len bytes or "error\n".
+bool serve_incremental(FILE *in, FILE *out, const incremental_options *options);
+
+#endif
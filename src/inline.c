@@ -0,0 +1,645 @@
+#include "inline.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "minify.h"
+#include "syntax.h"
+#include "tokenize.h"
+
+// Functions with a body of the form { return expr; } are inlined as
+// T(expr), with the parameters substituted by the call arguments. Arguments
+// and results whose type might be abstract are wrapped in a conversion to the
+// declared type, so that inlining never changes the type of an expression.
+
+#define MAX_PARAMS 16
+
+typedef struct name_entry {
+  char *name;
+  struct name_entry *next;
+} name_entry;
+
+typedef struct fn_info {
+  token_node *start;      // First token of the declaration
+  token_node *name;
+  token_node *end;        // Closing brace of the body
+  token_node *ret;        // Return type
+  token_node *expr_first; // Returned expression
+  token_node *expr_last;
+  const char *params[MAX_PARAMS];
+  token_node *param_types[MAX_PARAMS];
+  size_t param_count;
+  struct fn_info *next;
+} fn_info;
+
+typedef struct call_site {
+  token_node *callee;
+  token_node *close;
+  token_node *arg_first[MAX_PARAMS];
+  token_node *arg_last[MAX_PARAMS];
+  struct call_site *next;
+} call_site;
+
+typedef struct inline_context {
+  fn_info *functions;         // Functions that can be inlined
+  name_entry *function_names; // All functions
+  name_entry *runtime_values; // Names never declared as const
+  name_entry *const_values;
+} inline_context;
+
+bool add_name_entry(name_entry **first, const char *name)
+{
+  name_entry *e = malloc(sizeof(*e));
+  if(!e) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  // Copied, as the declaring tokens may be removed by inlining
+  *e = (name_entry){ strdup(name), *first };
+  if(!e->name) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(e);
+    return true;
+  }
+  *first = e;
+  return false;
+}
+
+bool has_name_entry(const name_entry *first, const char *name)
+{
+  while(first && strcmp(first->name, name) != 0)
+    first = first->next;
+  return first != NULL;
+}
+
+void free_name_entries(name_entry *first)
+{
+  while(first) {
+    name_entry *next = first->next;
+    free(first->name);
+    free(first);
+    first = next;
+  }
+}
+
+void free_fn_infos(fn_info *first)
+{
+  while(first) {
+    fn_info *next = first->next;
+    free(first);
+    first = next;
+  }
+}
+
+void free_call_sites(call_site *first)
+{
+  while(first) {
+    call_site *next = first->next;
+    free(first);
+    first = next;
+  }
+}
+
+bool is_plain_name(const token_node *node, const char *name)
+{
+  return node->type == IDENTIFIER && !is_sym(prev_sig(node), ".") &&
+    strcmp(node_value(node), name) == 0;
+}
+
+// Parses a function declaration of the form fn name(params) -> T { return e; }
+// without attributes. Returns NULL for any other function.
+fn_info *parse_function(token_node *keyword)
+{
+  const token_node *p = prev_sig(keyword);
+  if(is_sym(p, ")") || is_sym(prev_sig(p), "@"))
+    return NULL;
+
+  fn_info info = { keyword, NULL, NULL, NULL, NULL, NULL, { NULL }, { NULL }, 0, NULL };
+  info.name = (token_node *)next_sig(keyword);
+  const token_node *curr = next_sig(info.name);
+  if(!info.name || info.name->type != IDENTIFIER || !is_sym(curr, "("))
+    return NULL;
+
+  curr = next_sig(curr);
+  while(curr && !is_sym(curr, ")")) {
+    if(curr->type != IDENTIFIER || !is_sym(next_sig(curr), ":") ||
+        info.param_count == MAX_PARAMS)
+      return NULL;
+    info.params[info.param_count] = node_value(curr);
+    info.param_types[info.param_count++] = (token_node *)next_sig(next_sig(curr));
+    curr = skip_type(next_sig(next_sig(curr)));
+    if(is_sym(curr, ","))
+      curr = next_sig(curr);
+  }
+
+  if(!is_sym(next_sig(curr), "->"))
+    return NULL;
+  info.ret = (token_node *)next_sig(next_sig(curr));
+  curr = skip_type(info.ret);
+  if(!info.ret || is_sym(info.ret, "@") || !is_sym(curr, "{"))
+    return NULL;
+
+  info.end = (token_node *)find_close(curr, "{", "}");
+  if(!info.end || !is_kw(next_sig(curr), "return"))
+    return NULL;
+
+  info.expr_first = (token_node *)next_sig(next_sig(curr));
+  const token_node *semicolon = info.expr_first;
+  int depth = 0;
+  while(semicolon && semicolon != info.end && (depth > 0 || !is_sym(semicolon, ";"))) {
+    if(is_sym(semicolon, "(") || is_sym(semicolon, "["))
+      depth++;
+    else if(is_sym(semicolon, ")") || is_sym(semicolon, "]"))
+      depth--;
+    semicolon = next_sig(semicolon);
+  }
+  if(!is_sym(semicolon, ";") || next_sig(semicolon) != info.end ||
+      semicolon == info.expr_first)
+    return NULL;
+  info.expr_last = (token_node *)prev_sig(semicolon);
+
+  fn_info *fn = malloc(sizeof(*fn));
+  if(!fn) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return NULL;
+  }
+  *fn = info;
+
+  return fn;
+}
+
+bool collect_inline_context(inline_context *ctx, token_node *head)
+{
+  bool error = false;
+  for(token_node *curr = head; !error && curr; curr = curr->next) {
+    if(is_kw(curr, "fn")) {
+      if(next_sig(curr) && next_sig(curr)->type == IDENTIFIER)
+        error = add_name_entry(&ctx->function_names, node_value(next_sig(curr)));
+      fn_info *fn = parse_function(curr);
+      if(fn) {
+        fn->next = ctx->functions;
+        ctx->functions = fn;
+      }
+
+      // Parameters are runtime values, built-in ones may be named like
+      // keywords
+      const token_node *p = next_sig(next_sig(curr));
+      if(is_sym(p, "(")) {
+        const token_node *close = find_close(p, "(", ")");
+        for(p = next_sig(p); !error && p && p != close; p = next_sig(p))
+          if((p->type == IDENTIFIER || p->type == KEYWORD) &&
+              is_sym(next_sig(p), ":") && !is_sym(prev_sig(p), "."))
+            error = add_name_entry(&ctx->runtime_values, node_value(p));
+      }
+    } else if(is_kw(curr, "let") || is_kw(curr, "var") ||
+        is_kw(curr, "override") || is_kw(curr, "const")) {
+      const token_node *name = next_sig(curr);
+      if(is_kw(curr, "var") && is_sym(name, "<"))
+        name = skip_type(curr);
+      if(name && name->type == IDENTIFIER)
+        error = add_name_entry(is_kw(curr, "const") ? &ctx->const_values :
+            &ctx->runtime_values, node_value(name));
+    }
+  }
+
+  return error;
+}
+
+// Calls of user functions and built-ins with side effects are impure
+bool is_pure(const inline_context *ctx, const token_node *first,
+    const token_node *last)
+{
+  for(const token_node *curr = first; curr; curr = next_sig(curr)) {
+    if(is_sym(next_sig(curr), "(")) {
+      const char *name = node_value(curr);
+      if(curr->type == IDENTIFIER && has_name_entry(ctx->function_names, name))
+        return false;
+      if(curr->type == KEYWORD && (strncmp(name, "atomic", 6) == 0 ||
+          strcmp(name, "textureStore") == 0 ||
+          strcmp(name, "workgroupUniformLoad") == 0 ||
+          (strlen(name) > 7 && strcmp(name + strlen(name) - 7, "Barrier") == 0)))
+        return false;
+    }
+    if(curr == last)
+      break;
+  }
+  return true;
+}
+
+bool has_concrete_suffix(const char *literal)
+{
+  size_t len = strlen(literal);
+  char last = literal[len - 1];
+  if(strchr(literal, 'x') || strchr(literal, 'X'))
+    return last == 'i' || last == 'u' ||
+      ((strchr(literal, 'p') || strchr(literal, 'P')) && (last == 'f' || last == 'h'));
+  return last == 'i' || last == 'u' || last == 'f' || last == 'h';
+}
+
+bool is_convertible_type(const token_node *type);
+
+// Constructors of scalar, vector and matrix types with a concrete component
+// type, e.g. f32(...), vec3f(...) or vec3<f32>(...)
+bool is_concrete_constructor(const token_node *type)
+{
+  if(!is_convertible_type(type))
+    return false;
+  const char *name = node_value(type);
+  const token_node *next = next_sig(type);
+  if(strncmp(name, "vec", 3) != 0 && strncmp(name, "mat", 3) != 0)
+    return is_sym(next, "(");
+  if(is_sym(next, "<"))
+    return is_concrete_constructor(next_sig(next)) ||
+      is_kw(next_sig(next), "f32") || is_kw(next_sig(next), "f16") ||
+      is_kw(next_sig(next), "i32") || is_kw(next_sig(next), "u32");
+  return is_sym(next, "(") && strchr("fhiu", name[strlen(name) - 1]);
+}
+
+// An expression is concrete if it starts with a concrete constructor or
+// involves a runtime value or a suffixed literal. select() may still be
+// abstract when only its condition is.
+bool is_concrete(const inline_context *ctx, const token_node *first,
+    const token_node *last, const char *const *params, size_t param_count)
+{
+  if(is_concrete_constructor(first))
+    return true;
+
+  bool concrete = false;
+  for(const token_node *curr = first; curr; curr = next_sig(curr)) {
+    if(is_kw(curr, "select"))
+      return false;
+    if(curr->type == LITERAL && has_concrete_suffix(node_value(curr)))
+      concrete = true;
+    if((curr->type == IDENTIFIER || curr->type == KEYWORD) &&
+        !is_sym(prev_sig(curr), ".")) {
+      const char *name = node_value(curr);
+      for(size_t i=0; i<param_count; i++)
+        if(strcmp(params[i], name) == 0)
+          concrete = true;
+      if(has_name_entry(ctx->runtime_values, name) &&
+          !has_name_entry(ctx->const_values, name))
+        concrete = true;
+    }
+    if(curr == last)
+      break;
+  }
+  return concrete;
+}
+
+// Only scalar, vector and matrix types can be used as conversion
+bool is_convertible_type(const token_node *type)
+{
+  if(!type || type->type != KEYWORD)
+    return false;
+  const char *name = node_value(type);
+  return strcmp(name, "f32") == 0 || strcmp(name, "f16") == 0 ||
+    strcmp(name, "i32") == 0 || strcmp(name, "u32") == 0 ||
+    strcmp(name, "bool") == 0 || strncmp(name, "vec", 3) == 0 ||
+    strncmp(name, "mat", 3) == 0;
+}
+
+size_t range_len(const token_node *first, const token_node *last)
+{
+  size_t len = 0;
+  for(const token_node *curr = first; curr; curr = curr->next) {
+    len += strlen(node_value(curr));
+    if(curr == last)
+      break;
+  }
+  return len;
+}
+
+size_t count_uses(const token_node *first, const token_node *last, const char *name)
+{
+  size_t count = 0;
+  for(const token_node *curr = first; curr; curr = curr->next) {
+    if(is_plain_name(curr, name))
+      count++;
+    if(curr == last)
+      break;
+  }
+  return count;
+}
+
+bool append_copy(token_node **last, const token_node *first, const token_node *end)
+{
+  for(const token_node *curr = first; curr; curr = curr->next) {
+    if(create_token_node_with_token(last, curr->type, node_value(curr)))
+      return true;
+    if(curr == end)
+      break;
+  }
+  return false;
+}
+
+// Whether the expression consists of a name or literal followed by member
+// accesses, indices and call arguments only
+bool is_postfix_expr(const token_node *first, const token_node *last)
+{
+  int depth = 0;
+  for(const token_node *curr = first; curr; curr = next_sig(curr)) {
+    if(is_sym(curr, "(") || is_sym(curr, "[") ||
+        (is_sym(curr, "<") && prev_sig(curr)->type == KEYWORD))
+      depth++;
+    else if(is_sym(curr, ")") || is_sym(curr, "]") || (depth > 0 &&
+          (is_sym(curr, ">") || is_sym(curr, ">>"))))
+      depth -= is_sym(curr, ">>") ? 2 : 1;
+    else if(depth == 0 && curr->type == SYMBOL && !is_sym(curr, "."))
+      return false;
+    if(curr == last)
+      break;
+  }
+  return depth == 0 && first->type != SYMBOL;
+}
+
+// Appends the expression, wrapped in T(...) if its type might be abstract or
+// in (...) if it is not a postfix expression
+bool append_wrapped(token_node **last, const token_node *first,
+    const token_node *end, const token_node *type, bool concrete)
+{
+  bool convert = !concrete && is_convertible_type(type);
+  bool parens = convert || !is_postfix_expr(first, end);
+  bool error = false;
+  if(convert)
+    error = append_copy(last, type, prev_sig(skip_type(type)));
+  if(!error && parens)
+    error = create_token_node_with_token(last, SYMBOL, "(");
+  if(!error)
+    error = append_copy(last, first, end);
+  if(!error && parens)
+    error = create_token_node_with_token(last, SYMBOL, ")");
+  return error;
+}
+
+// Whether the call is a complete expression, so that its replacement does
+// not need parentheses
+bool is_standalone(const call_site *call)
+{
+  const char *assignments[] = { "=", "+=", "-=", "*=", "/=", "%=", "&=", "|=",
+    "^=", ">>=", "<<=", "(", "[", "," };
+  const token_node *p = prev_sig(call->callee), *n = next_sig(call->close);
+  if(!is_sym(n, ")") && !is_sym(n, "]") && !is_sym(n, ",") && !is_sym(n, ";"))
+    return false;
+  if(is_kw(p, "return"))
+    return true;
+  for(size_t i=0; i<sizeof(assignments) / sizeof(assignments[0]); i++)
+    if(is_sym(p, assignments[i]))
+      return true;
+  return false;
+}
+
+// Creates the detached token sequence replacing the given call
+bool create_expansion(const inline_context *ctx, const fn_info *fn,
+    const call_site *call, token_node **first)
+{
+  token_node *last = NULL;
+  bool error = false;
+  bool concrete = is_concrete(ctx, fn->expr_first, fn->expr_last,
+      fn->params, fn->param_count);
+
+  // The expression with substituted parameters is assembled first and then
+  // wrapped as a whole
+  token_node *expr_last = NULL;
+  for(token_node *curr = fn->expr_first; !error && curr; curr = curr->next) {
+    size_t p = fn->param_count;
+    if(curr->type == IDENTIFIER && !is_sym(prev_sig(curr), "."))
+      for(p=0; p<fn->param_count; p++)
+        if(strcmp(fn->params[p], node_value(curr)) == 0)
+          break;
+
+    if(p < fn->param_count)
+      error = append_wrapped(&expr_last, call->arg_first[p], call->arg_last[p],
+          fn->param_types[p], is_concrete(ctx, call->arg_first[p],
+            call->arg_last[p], NULL, 0));
+    else
+      error = create_token_node_with_token(&expr_last, curr->type, node_value(curr));
+
+    if(curr == fn->expr_last)
+      break;
+  }
+
+  token_node *expr_first = expr_last;
+  while(expr_first && expr_first->prev)
+    expr_first = expr_first->prev;
+
+  if(!error && is_standalone(call) && (concrete || !is_convertible_type(fn->ret)))
+    error = append_copy(&last, expr_first, expr_last);
+  else if(!error)
+    error = append_wrapped(&last, expr_first, expr_last, fn->ret, concrete);
+  free_token_nodes(expr_first);
+
+  if(error) {
+    while(last && last->prev)
+      last = last->prev;
+    free_token_nodes(last);
+    return true;
+  }
+
+  while(last && last->prev)
+    last = last->prev;
+  *first = last;
+
+  return false;
+}
+
+// Whether the name is declared as parameter or local in the function
+// containing the given token
+bool is_local_name(const token_node *node, const char *name)
+{
+  const token_node *fn = node;
+  while(fn && !is_kw(fn, "fn"))
+    fn = fn->prev;
+  if(!fn)
+    return false;
+
+  bool params = true;
+  const token_node *end = NULL;
+  for(const token_node *curr = next_sig(fn); curr && curr != end; curr = next_sig(curr)) {
+    if(params && is_sym(curr, "{")) {
+      params = false;
+      end = find_close(curr, "{", "}");
+    }
+    if(curr->type != IDENTIFIER || strcmp(node_value(curr), name) != 0)
+      continue;
+    const token_node *p = prev_sig(curr);
+    if(is_kw(p, "let") || is_kw(p, "var") || is_kw(p, "const") ||
+        (is_sym(p, ">") && is_kw(prev_sig(find_template_open(p)), "var")) ||
+        (params && is_sym(next_sig(curr), ":")))
+      return true;
+  }
+
+  return false;
+}
+
+// Collects the calls in reverse order. Fails if the function name is used
+// in any other way.
+bool find_call_sites(const fn_info *fn, token_node *head, call_site **calls,
+    bool *valid)
+{
+  const char *name = node_value(fn->name);
+  *valid = true;
+  for(token_node *curr = head; curr && *valid; curr = curr->next) {
+    if(curr == fn->name || !is_plain_name(curr, name))
+      continue;
+
+    const token_node *open = next_sig(curr);
+    const token_node *close = is_sym(open, "(") ? find_close(open, "(", ")") : NULL;
+    if(!close) {
+      *valid = false;
+      break;
+    }
+
+    call_site *call = malloc(sizeof(*call));
+    if(!call) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      return true;
+    }
+    *call = (call_site){ curr, (token_node *)close, { NULL }, { NULL }, *calls };
+    *calls = call;
+
+    size_t arg = 0;
+    int depth = 0;
+    const token_node *arg_first = next_sig(open);
+    for(const token_node *a = arg_first; a && *valid; a = next_sig(a)) {
+      if(depth == 0 && (a == close || is_sym(a, ","))) {
+        if(a == arg_first || arg == fn->param_count)
+          *valid = a == close && a == arg_first && fn->param_count == 0;
+        else {
+          call->arg_first[arg] = (token_node *)arg_first;
+          call->arg_last[arg++] = (token_node *)prev_sig(a);
+        }
+        arg_first = next_sig(a);
+        if(a == close)
+          break;
+        continue;
+      }
+      if(is_sym(a, "(") || is_sym(a, "["))
+        depth++;
+      else if(is_sym(a, ")") || is_sym(a, "]"))
+        depth--;
+    }
+    *valid = *valid && arg == fn->param_count;
+  }
+
+  return false;
+}
+
+bool is_inlineable(const inline_context *ctx, const fn_info *fn,
+    const call_site *calls, size_t threshold)
+{
+  size_t call_count = 0, expr_tokens = 0;
+  for(const call_site *call = calls; call; call = call->next)
+    call_count++;
+  for(const token_node *curr = fn->expr_first; curr; curr = next_sig(curr)) {
+    expr_tokens++;
+    if(curr == fn->expr_last)
+      break;
+  }
+  if(call_count == 0 || (call_count > 1 && expr_tokens > threshold))
+    return false;
+
+  // Names referenced by the body must not be shadowed at any call site
+  for(const token_node *curr = fn->expr_first; curr; curr = next_sig(curr)) {
+    if(curr->type == IDENTIFIER && !is_sym(prev_sig(curr), ".")) {
+      bool param = false;
+      for(size_t i=0; i<fn->param_count; i++)
+        param = param || strcmp(fn->params[i], node_value(curr)) == 0;
+      for(const call_site *call = calls; !param && call; call = call->next)
+        if(is_local_name(call->callee, node_value(curr)))
+          return false;
+    }
+    if(curr == fn->expr_last)
+      break;
+  }
+
+  // Arguments with side effects need to be evaluated exactly once and must
+  // not be reordered with other side effects
+  bool expr_pure = is_pure(ctx, fn->expr_first, fn->expr_last);
+  for(const call_site *call = calls; call; call = call->next) {
+    size_t impure = 0;
+    for(size_t i=0; i<fn->param_count; i++) {
+      if(is_pure(ctx, call->arg_first[i], call->arg_last[i]))
+        continue;
+      if(++impure > 1 || !expr_pure ||
+          count_uses(fn->expr_first, fn->expr_last, fn->params[i]) != 1)
+        return false;
+    }
+  }
+
+  for(size_t i=0; i<fn->param_count; i++) {
+    const token_node *type = fn->param_types[i];
+    if(!is_convertible_type(type) && type->type != IDENTIFIER)
+      return false;
+  }
+
+  return true;
+}
+
+bool try_inline(const inline_context *ctx, fn_info *fn, token_node **head,
+    const exclude_set *excludes, size_t threshold, bool *inlined)
+{
+  if(is_excluded(node_value(fn->name), excludes))
+    return false;
+
+  call_site *calls = NULL;
+  bool valid;
+  bool error = find_call_sites(fn, *head, &calls, &valid);
+  if(error || !valid || !is_inlineable(ctx, fn, calls, threshold)) {
+    free_call_sites(calls);
+    return error;
+  }
+
+  // Inline only if the output does not grow
+  size_t decl_len = range_len(fn->start, fn->end), growth = 0;
+  for(call_site *call = calls; !error && call; call = call->next) {
+    token_node *expansion = NULL;
+    error = create_expansion(ctx, fn, call, &expansion);
+    if(!error) {
+      growth += range_len(expansion, NULL);
+      growth -= range_len(call->callee, call->close) < growth ?
+        range_len(call->callee, call->close) : growth;
+    }
+    free_token_nodes(expansion);
+  }
+
+  if(!error && growth <= decl_len) {
+    // Calls are in reverse order, so nested calls are replaced first
+    for(call_site *call = calls; !error && call; call = call->next) {
+      token_node *expansion = NULL;
+      error = create_expansion(ctx, fn, call, &expansion);
+      if(!error)
+        splice_nodes(head, call->callee, call->close, expansion);
+    }
+    if(!error) {
+      splice_nodes(head, fn->start, fn->end, NULL);
+      *inlined = true;
+    }
+  }
+
+  free_call_sites(calls);
+
+  return error;
+}
+
+bool inline_functions(token_node **head, const exclude_set *excludes,
+    size_t threshold)
+{
+  bool error = false, inlined = true;
+  while(!error && inlined) {
+    inline_context ctx = { NULL, NULL, NULL, NULL };
+    inlined = false;
+    error = collect_inline_context(&ctx, *head);
+    for(fn_info *fn = ctx.functions; !error && !inlined && fn; fn = fn->next)
+      error = try_inline(&ctx, fn, head, excludes, threshold, &inlined);
+    free_fn_infos(ctx.functions);
+    free_name_entries(ctx.function_names);
+    free_name_entries(ctx.runtime_values);
+    free_name_entries(ctx.const_values);
+  }
+
+  if(!error)
+    compress_whitespaces(head);
+
+  return error;
+}
@@ -0,0 +1,16 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct exclude_set exclude_set;
+typedef struct token_node token_node;
+
+// Inlines functions consisting of a single return statement if they are
+// called only once or if their expression has at most threshold tokens, as
+// long as this does not increase the output size.
+bool inline_functions(token_node **head, const exclude_set *excludes,
+    size_t threshold);
+
+#endif
@@ -1,4 +1,5 @@
 #include "keywords.h"
+#include <string.h>
 
 // Keywords and symbols taken from the WGSL spec at:
 // https://www.w3.org/TR/WGSL/
@@ -512,3 +513,15 @@ const char *keywords[] = {
 };
 
 const size_t keywords_count = sizeof(keywords) / sizeof(keywords[0]);
+
+// Keywords from the value constructors on are built-in types and functions
+bool is_builtin_value(const char *name)
+{
+  bool builtin = false;
+  for(size_t i=0; i<keywords_count; i++) {
+    builtin = builtin || strcmp(keywords[i], "bool") == 0;
+    if(strcmp(keywords[i], name) == 0)
+      return builtin;
+  }
+  return false;
+}
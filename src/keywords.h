@@ -1,6 +1,7 @@
 #ifndef KEYWORDS_H
 #define KEYWORDS_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 extern const char *symbols[];
@@ -10,4 +11,7 @@ extern const size_t max_symbol_len;
 extern const char *keywords[];
 extern const size_t keywords_count;
 
+// Value constructors, built-in functions and other predeclared type names
+bool is_builtin_value(const char *name);
+
 #endif
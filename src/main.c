@@ -4,18 +4,54 @@
 // Author: Markus Gnauck
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "buffer.h"
+#include "elide.h"
+#include "embed.h"
+#include "explain.h"
+#include "incremental.h"
+#include "inline.h"
+#include "preprocess.h"
+#include "reflect.h"
+#include "shake.h"
+#include "stream.h"
 #include "tokenize.h"
+#include "trace.h"
+#include "watch.h"
+#include "memory.h"
 #include "minify.h"
 
 typedef struct arguments {
   char *filename;
-  char *excludes;
+  exclude_set excludes;
   bool no_mangle;
   bool print_unused;
+  bool extended_alphabet;
+  bool compress_aware;
+  bool inline_functions;
+  size_t inline_threshold;
+  bool incremental;
+  define *defines;
+  char *variants;
+  bool script;
+  char *output;
+  size_t threads;
+  char *dump_tokens;
+  char *load_tokens;
+  size_t max_memory;
+  bool memory_stats;
+  bool compact;
+  char *reflect;
+  bool dedup;
+  bool pool_literals;
+  bool elide;
+  bool explain;
+  char *trace;
+  char *watch;
+  bool split;
   bool help;
 } arguments;
 
@@ -30,10 +66,10 @@ bool handle_arguments(int argc, char *argv[], arguments *args)
     }
 
     if(strcmp(argv[i], "--no-mangle") == 0) {
-      if(!args->excludes && !args->print_unused) {
+      if(!has_excludes(&args->excludes) && !args->print_unused) {
         args->no_mangle = true;
         continue;
-      } else if(args->excludes) {
+      } else if(has_excludes(&args->excludes)) {
         printf("%s: specify excluded identifiers or --no-mangle\n", argv[0]);
         error = true;
         break;
@@ -45,6 +81,11 @@ bool handle_arguments(int argc, char *argv[], arguments *args)
     }
 
     if(strcmp(argv[i], "--print-unused") == 0) {
+      if(args->incremental) {
+        printf("%s: specify --incremental or --print-unused\n", argv[0]);
+        error = true;
+        break;
+      }
       if(!args->no_mangle) {
         args->print_unused = true;
         continue;
@@ -55,14 +96,234 @@ bool handle_arguments(int argc, char *argv[], arguments *args)
       }
     }
  
-    if(strcmp(argv[i], "-e") == 0) {
+    if(strcmp(argv[i], "--extended-alphabet") == 0) {
+      args->extended_alphabet = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--compress-aware") == 0) {
+      args->compress_aware = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--split") == 0) {
+      args->split = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--watch") == 0) {
+      if(i + 1 < (size_t)argc) {
+        args->watch = argv[++i];
+        continue;
+      } else {
+        printf("%s: --watch requires a directory\n", argv[0]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strcmp(argv[i], "--trace") == 0) {
+      if(i + 1 < (size_t)argc) {
+        args->trace = argv[++i];
+        continue;
+      } else {
+        printf("%s: --trace requires a file name\n", argv[0]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strcmp(argv[i], "--explain") == 0) {
+      args->explain = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--elide") == 0) {
+      args->elide = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--dedup") == 0) {
+      args->dedup = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--pool-literals") == 0) {
+      args->pool_literals = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--inline") == 0) {
+      args->inline_functions = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--inline-threshold") == 0) {
+      char *end = NULL;
+      if((size_t)argc >= i + 2)
+        args->inline_threshold = strtoul(argv[i + 1], &end, 10);
+      if(end && end != argv[i + 1] && *end == '\0') {
+        args->inline_functions = true;
+        i++;
+        continue;
+      } else {
+        printf("%s: illegal value for option %s\n", argv[0], argv[i]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strncmp(argv[i], "-D", 2) == 0) {
+      const char *def = argv[i][2] ? argv[i] + 2 :
+        ((size_t)argc >= i + 2 ? argv[++i] : NULL);
+      if(def && !add_define(&args->defines, def))
+        continue;
+      printf("%s: illegal value for option -D\n", argv[0]);
+      error = true;
+      break;
+    }
+
+    if(strcmp(argv[i], "--threads") == 0) {
+      char *end = NULL;
+      if((size_t)argc >= i + 2)
+        args->threads = strtoul(argv[i + 1], &end, 10);
+      if(end && end != argv[i + 1] && *end == '\0' && args->threads > 0) {
+        i++;
+        continue;
+      } else {
+        printf("%s: illegal value for option %s\n", argv[0], argv[i]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strcmp(argv[i], "--dump-tokens") == 0 ||
+        strcmp(argv[i], "--load-tokens") == 0) {
+      if((size_t)argc >= i + 2) {
+        if(argv[i][2] == 'd')
+          args->dump_tokens = argv[++i];
+        else
+          args->load_tokens = argv[++i];
+        continue;
+      } else {
+        printf("%s: illegal value for option %s\n", argv[0], argv[i]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strcmp(argv[i], "--max-memory") == 0) {
+      char *end = NULL;
+      errno = 0;
+      if((size_t)argc >= i + 2 && argv[i + 1][0] != '-')
+        args->max_memory = strtoul(argv[i + 1], &end, 10);
+      if(end && end != argv[i + 1]) {
+        // Optional K, M or G suffix
+        size_t unit = *end == 'K' ? 1 << 10 : *end == 'M' ? 1 << 20 :
+          *end == 'G' ? 1 << 30 : 1;
+        if(errno == ERANGE || args->max_memory > SIZE_MAX / unit)
+          end = NULL;
+        else {
+          args->max_memory *= unit;
+          end += unit > 1;
+        }
+      }
+      if(end && end != argv[i + 1] && *end == '\0' && args->max_memory > 0) {
+        i++;
+        continue;
+      } else {
+        printf("%s: illegal value for option %s\n", argv[0], argv[i]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strcmp(argv[i], "--memory-stats") == 0) {
+      args->memory_stats = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--compact") == 0) {
+      args->compact = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "--reflect") == 0) {
+      if((size_t)argc >= i + 2) {
+        args->reflect = argv[++i];
+        continue;
+      } else {
+        printf("%s: illegal value for option %s\n", argv[0], argv[i]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strcmp(argv[i], "--js") == 0) {
+      args->script = true;
+      continue;
+    }
+
+    if(strcmp(argv[i], "-o") == 0) {
+      if((size_t)argc >= i + 2) {
+        args->output = argv[++i];
+        continue;
+      } else {
+        printf("%s: illegal value for option %s\n", argv[0], argv[i]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strcmp(argv[i], "--variants") == 0) {
+      if(args->incremental) {
+        printf("%s: specify --incremental or --variants\n", argv[0]);
+        error = true;
+        break;
+      }
+      if((size_t)argc >= i + 2) {
+        args->variants = argv[++i];
+        continue;
+      } else {
+        printf("%s: illegal value for option %s\n", argv[0], argv[i]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strcmp(argv[i], "--incremental") == 0) {
+      if(args->variants) {
+        printf("%s: specify --variants or --incremental\n", argv[0]);
+        error = true;
+        break;
+      }
+      if(!args->print_unused) {
+        args->incremental = true;
+        continue;
+      } else {
+        printf("%s: specify --print-unused or --incremental\n", argv[0]);
+        error = true;
+        break;
+      }
+    }
+
+    if(strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "--exclude-file") == 0) {
       if(args->no_mangle) {
         printf("%s: specify --no-mangle or excluded identifiers\n", argv[0]);
         error = true;
         break;
       }
       if((size_t)argc >= i + 2 && strcmp(argv[i + 1], "-") != 0) {
-        args->excludes = argv[++i];
+        // -e @file reads the names from a file like --exclude-file
+        const char *value = argv[++i];
+        if(argv[i - 1][1] == '-')
+          error = read_exclude_file(&args->excludes, value);
+        else if(value[0] == '@')
+          error = read_exclude_file(&args->excludes, value + 1);
+        else
+          error = add_exclude_list(&args->excludes, value);
+        if(error)
+          break;
         continue;
       } else {
         printf("%s: illegal value for option %s\n", argv[0], argv[i]);
@@ -98,72 +359,211 @@ bool handle_arguments(int argc, char *argv[], arguments *args)
     break;
   }
 
-  if(args->excludes) {
-    size_t len = strlen(args->excludes);
-    for(size_t i=0; i<len; i++) {
-      if(args->excludes[i] != ',' && !is_name(args->excludes[i], ((i==0) || args->excludes[i - 1] == ',') ? 0 : 1)) {
-        printf("%s: illegal character '%c' in excluded identifier\n", argv[0], args->excludes[i]);
-        error = true;
-      }
-    }
-  }
-
   if(args->help || error)
-    printf("usage: wgslminify [--no-mangle | --print-unused | -e exclude1,exclude2,...] [file]\n");
+    printf("usage: wgslminify [--no-mangle | --print-unused | -e exclude1,exclude2,... | -e @file | --exclude-file file] [--extended-alphabet] [--compress-aware] [--elide] [--dedup] [--pool-literals] [--inline] [--inline-threshold n] [--incremental] [-D name[=value]] [--variants file] [--js] [-o output] [--threads n] [--dump-tokens file] [--load-tokens file] [--max-memory n[K|M|G]] [--memory-stats] [--compact] [--reflect file] [--explain] [--trace file] [--watch dir -o outdir] [--split -o outdir] [file]\n");
+  if(args->help)
+    printf("--max-memory and --memory-stats cover source, tokens and identifier tables, not the working memory of the individual passes\n");
 
   return error;
 }
 
-size_t get_excludes_count(const char *excl_str)
+// Passes on the whole module, up to the point where modules are split
+bool optimize_tokens(token_node **head, const arguments *args)
 {
-  size_t cnt = 0;
-  while(*excl_str != '\0')
-    if(*excl_str++ == ',')
-      cnt++;
+  uint64_t begin = trace_begin();
+  bool error = preprocess(head, args->defines);
+  trace_end("preprocess", begin);
+  if(!error)
+    error = minify(head);
+  begin = trace_begin();
+  if(!error && args->elide)
+    error = elide_annotations(head);
+  if(!error && args->dedup)
+    error = dedup_declarations(head, &args->excludes);
+  if(!error && args->inline_functions)
+    error = inline_functions(head, &args->excludes, args->inline_threshold);
+  trace_end("optimize", begin);
+  return error;
+}
 
-  return cnt + 1;
+// Mangles and prints the tokens, which are freed afterwards
+bool emit_tokens(token_node *head, const arguments *args, FILE *out,
+    size_report *report)
+{
+  bool error = false;
+  uint64_t begin;
+  // Pooled literals are named by mangling only
+  if(args->pool_literals && !args->no_mangle && !args->print_unused) {
+    begin = trace_begin();
+    error = pool_literals(&head);
+    trace_end("pool_literals", begin);
+  }
+  reflection *reflected = NULL;
+  if(!error && args->reflect)
+    error = collect_reflection(head, &reflected);
+  if(!error && report)
+    error = explain_names(head, report);
+  mangled_names names = { NULL, 0 };
+  if(!error && !args->no_mangle) {
+    mangle_options options = { &args->excludes, args->print_unused,
+      args->extended_alphabet, args->compress_aware, NULL, args->threads };
+    begin = trace_begin();
+    error = mangle(&head, &options, &names);
+    trace_end("mangle", begin);
+  }
+  if(!error && args->reflect)
+    error = write_reflection(args->reflect, reflected);
+  free_reflection(reflected);
+  if(!error && report)
+    error = explain_output(head, report);
+  begin = trace_begin();
+  if(!error && !args->print_unused)
+    write_tokens_as_text(out, head);
+  trace_end("output", begin);
+  free_token_nodes(head);
+  free_mangled_names(&names);
+
+  return error;
 }
 
-void free_excludes(char **exclude_names, size_t exclude_count)
+// Preprocesses, minifies and prints the tokens, which are freed afterwards
+bool process_tokens(token_node *head, const arguments *args, FILE *out)
 {
-  for(size_t i=0; i<exclude_count; i++)
-    free(exclude_names[i]);
-  free(exclude_names);
+  size_report report = { { 0 }, { 0 }, NULL, NULL, 0, NULL, 0, NULL, 0 };
+  bool error = args->explain && explain_input(head, &report);
+  if(!error)
+    error = optimize_tokens(&head, args);
+  if(!error) {
+    error = emit_tokens(head, args, out, args->explain ? &report : NULL);
+    head = NULL;
+  }
+  if(!error && args->explain)
+    print_size_report(stderr, &report);
+  free_size_report(&report);
+  free_token_nodes(head);
+
+  return error;
 }
 
-bool parse_excludes(const char *exclude_string, char **exclude_names, size_t *exclude_count)
+// Writes a module for each entry point of the tokens into the output
+// directory, named after the entry point. Passes on the whole module run
+// once, each module is mangled on its own except for its entry point.
+bool split_entry_points(token_node *head, arguments *args)
 {
-  size_t len = strlen(exclude_string);
-  size_t i = 0, cnt = 0;
-  buffer buf = { NULL, 0, 0 };
-  while(i < len && cnt < *exclude_count) {
-    char c = exclude_string[i];
-    if(c != ',') {
-      if(write_buf(&buf, c)) {
-        free(buf.ptr);
-        free_excludes(exclude_names, cnt);
-        return true;
-      }
+  reflection *reflected = NULL;
+  module_declarations decls = { NULL, 0, NULL, 0, NULL };
+  bool error = optimize_tokens(&head, args) ||
+    collect_reflection(head, &reflected) ||
+    collect_module_declarations(head, &decls);
+
+  // Entry points keep their names, the host refers to them by file name
+  for(const reflection *r = reflected; !error && r; r = r->next)
+    if(r->kind == ENTRY_POINT)
+      error = add_exclude(&args->excludes, r->name, strlen(r->name));
+
+  for(const reflection *r = reflected; !error && r; r = r->next) {
+    if(r->kind != ENTRY_POINT)
+      continue;
+    size_t len = strlen(args->output) + strlen(r->name) + 7;
+    char *path = malloc(len);
+    if(!path) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      error = true;
+      break;
     }
-    if((c == ',' || i + 1 == len) && buf.pos > 0) {
-      char *name = buf_to_str(&buf, true);
-      if(!name) {
-        free_excludes(exclude_names, cnt);
-        return true;
-      }
-      exclude_names[cnt++] = name;
+    snprintf(path, len, "%s/%s.wgsl", args->output, r->name);
+    FILE *out = fopen(path, "w");
+    if(!out) {
+      fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+      error = true;
+    }
+    token_node *copy = NULL;
+    uint64_t begin = trace_begin();
+    if(!error)
+      error = copy_reachable(&decls, r->name, &copy);
+    trace_end("shake", begin);
+    if(!error)
+      error = emit_tokens(copy, args, out, NULL);
+    if(out && fclose(out) != 0) {
+      fprintf(stderr, "Failed to close file: %s\n", strerror(errno));
+      error = true;
     }
-    i++;
+    free(path);
   }
+  free_module_declarations(&decls);
+  free_reflection(reflected);
+  free_token_nodes(head);
 
-  *exclude_count = cnt;
+  return error;
+}
+
+typedef struct watch_context {
+  const arguments *args;
+  token_arena *arena;
+} watch_context;
+
+// Minifies a file of the watched directory. The output is written to a
+// temporary file first, so readers never see a partly written shader.
+bool minify_watched(const char *src_path, const char *dst_path, void *data)
+{
+  const watch_context *ctx = data;
+  FILE *in = fopen(src_path, "rt");
+  if(!in) {
+    fprintf(stderr, "Failed to open '%s': %s\n", src_path, strerror(errno));
+    return true;
+  }
+
+  token_node *head = NULL;
+  char *src = NULL;
+  size_t len = 0;
+  bool error = read_file(in, &src, &len) ||
+    tokenize_parallel(src, len, ctx->args->threads, &head);
+  free_source(src, len);
+  fclose(in);
+
+  size_t tmp_len = strlen(dst_path) + 5;
+  char *tmp_path = malloc(tmp_len);
+  if(!error && !tmp_path) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    error = true;
+  }
+  FILE *out = NULL;
+  if(!error) {
+    snprintf(tmp_path, tmp_len, "%s.tmp", dst_path);
+    out = fopen(tmp_path, "w");
+    if(!out) {
+      fprintf(stderr, "Failed to open '%s': %s\n", tmp_path, strerror(errno));
+      error = true;
+    }
+  }
 
-  return false;
+  if(!error) {
+    error = process_tokens(head, ctx->args, out);
+    head = NULL;
+  }
+  if(out && fclose(out) != 0) {
+    fprintf(stderr, "Failed to close file: %s\n", strerror(errno));
+    error = true;
+  }
+  if(out && !error && rename(tmp_path, dst_path) != 0) {
+    fprintf(stderr, "Failed to rename '%s': %s\n", tmp_path, strerror(errno));
+    error = true;
+  }
+  if(out && error)
+    remove(tmp_path);
+  free(tmp_path);
+  free_token_nodes(head);
+
+  // Tokens of the next file reuse the blocks of this one
+  reset_token_arena(ctx->arena);
+
+  return error;
 }
 
 int main(int argc, char *argv[])
 {
-  arguments args = { NULL, NULL, false, false, false };
+  arguments args = { NULL, { NULL, 0, 0, NULL, 0 }, false, false, false, false, false, 16, false,
+    NULL, NULL, false, NULL, 1, NULL, NULL, 0, false, false, NULL, false, false, false, false, false, NULL, NULL, false };
   if(handle_arguments(argc, argv, &args))
     return EXIT_FAILURE;
 
@@ -180,33 +580,163 @@ int main(int argc, char *argv[])
   } else
     file = stdin;
 
-  bool error = false;
-  char **exclude_names = NULL;
-  size_t exclude_count = 0;
-  if(args.excludes) {
-    exclude_count = get_excludes_count(args.excludes);
-    exclude_names = malloc(exclude_count * sizeof(*exclude_names));
-    if(exclude_names) {
-      error = parse_excludes(args.excludes, exclude_names, &exclude_count);
-      if(error)
-        free_excludes(exclude_names, exclude_count);
-    } else
-      error = true;
+  if(args.filename && is_script_name(args.filename))
+    args.script = true;
+  if(args.script && (args.inline_functions || args.variants || args.incremental)) {
+    fprintf(stderr, "Scripts do not support --inline, --variants or --incremental\n");
+    exit(EXIT_FAILURE);
+  }
+  if(args.load_tokens && (args.filename || args.script || args.incremental)) {
+    fprintf(stderr, "Specify an input file, --js or --incremental or --load-tokens\n");
+    exit(EXIT_FAILURE);
   }
 
-  if(!error) {
+  if(args.reflect && (args.script || args.variants || args.incremental)) {
+    fprintf(stderr, "Specify --reflect or --js, --variants or --incremental\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(args.explain && (args.script || args.variants || args.incremental)) {
+    fprintf(stderr, "Specify --explain or --js, --variants or --incremental\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(args.compact && args.incremental) {
+    fprintf(stderr, "Specify --compact or --incremental\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(args.watch && (args.filename || args.script || args.incremental ||
+        args.variants || args.load_tokens || args.dump_tokens || args.reflect ||
+        args.trace || args.print_unused || !args.output)) {
+    fprintf(stderr, "Specify --watch with an output directory (-o) and without "
+        "an input file, --js, --incremental, --variants, --load-tokens, "
+        "--dump-tokens, --reflect, --trace or --print-unused\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(args.split && (args.script || args.incremental || args.variants ||
+        args.reflect || args.explain || args.watch || args.print_unused ||
+        !args.output)) {
+    fprintf(stderr, "Specify --split with an output directory (-o) and without "
+        "--js, --incremental, --variants, --reflect, --explain, --watch or "
+        "--print-unused\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(!args.watch && !args.split && args.output &&
+      !freopen(args.output, "w", stdout)) {
+    fprintf(stderr, "Failed to open '%s': %s\n", args.output, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  set_memory_limit(args.max_memory);
+  if(args.trace)
+    start_trace(args.filename ? args.filename : args.load_tokens);
+  token_arena *arena = NULL;
+  // Watching keeps the arena across files
+  if(args.compact || args.watch) {
+    arena = create_token_arena();
+    set_token_arena(arena);
+  }
+
+  bool error = args.compact && !arena;
+
+  if(!error && args.script) {
+    mangle_options options = { &args.excludes, args.print_unused,
+      args.extended_alphabet, args.compress_aware, NULL, args.threads };
+    embed_options embed_opts = { args.no_mangle ? NULL : &options, args.defines };
+    char *src = NULL, *output = NULL;
+    size_t len = 0;
+    uint64_t begin = trace_begin();
+    error = read_file(file, &src, &len);
+    trace_end("load", begin);
+    begin = trace_begin();
+    if(!error)
+      error = minify_embedded(src, len, &embed_opts, &output);
+    trace_end("minify_embedded", begin);
+    begin = trace_begin();
+    if(!error && !args.print_unused)
+      fputs(output, stdout);
+    trace_end("output", begin);
+    free_source(src, len);
+    free(output);
+  } else if(!error && args.watch) {
+    watch_context ctx = { &args, arena };
+    error = watch_directory(args.watch, args.output, minify_watched, &ctx);
+  } else if(!error && args.incremental) {
+    mangle_options options = { &args.excludes, false, args.extended_alphabet,
+      args.compress_aware, NULL, args.threads };
+    incremental_options inc_options = { args.no_mangle ? NULL : &options,
+      args.inline_functions, args.inline_threshold, args.defines };
+    error = serve_incremental(file, stdout, &inc_options);
+  } else if(!error) {
+    variant *variants = NULL;
+    if(args.variants) {
+      FILE *variants_file = fopen(args.variants, "rt");
+      if(variants_file) {
+        error = read_variants(variants_file, &variants);
+        fclose(variants_file);
+      } else {
+        fprintf(stderr, "Failed to open '%s': %s\n", args.variants, strerror(errno));
+        error = true;
+      }
+    }
+
     token_node *head = NULL;
-    error = tokenize(file, &head);
-    if(!error && head) {
-      error = minify(&head);
-      if(!error && !args.no_mangle)
-        error = mangle(&head, (const char **)exclude_names, exclude_count, args.print_unused); 
-      if(!error && !args.print_unused)
-        print_tokens_as_text(head);
-      free_token_nodes(head);
-      free_excludes(exclude_names, exclude_count);
+    token_stream stream = { NULL, 0, NULL, NULL, 0 };
+    char *src = NULL;
+    size_t len = 0;
+    uint64_t begin = trace_begin();
+    if(!error && args.load_tokens)
+      error = load_token_stream(args.load_tokens, &stream, &head);
+    else if(!error)
+      error = read_file(file, &src, &len);
+    trace_end("load", begin);
+    begin = trace_begin();
+    if(!error && !args.load_tokens)
+      error = tokenize_parallel(src, len, args.threads, &head);
+    trace_end("tokenize", begin);
+    free_source(src, len);
+    if(!error && args.dump_tokens) {
+      begin = trace_begin();
+      error = write_token_stream(args.dump_tokens, head);
+      trace_end("dump_tokens", begin);
+    }
+    if(!error && args.variants) {
+      // Variant defines follow the ones given on the command line
+      define **defines_tail = &args.defines;
+      while(*defines_tail)
+        defines_tail = &(*defines_tail)->next;
+      for(variant *v = variants; !error && v; v = v->next) {
+        token_node *copy = NULL;
+        *defines_tail = v->defines;
+        error = copy_token_nodes(head, &copy) ||
+          process_tokens(copy, &args, stdout);
+      }
+      *defines_tail = NULL;
+    } else if(!error && head && args.split) {
+      error = split_entry_points(head, &args);
+      head = NULL;
+    } else if(!error && head) {
+      error = process_tokens(head, &args, stdout);
+      head = NULL;
     }
+    free_token_nodes(head);
+    free_token_stream(&stream);
+    free_variants(variants);
   }
+  free_defines(args.defines);
+  free_exclude_set(&args.excludes);
+  set_token_arena(NULL);
+  free_token_arena(arena);
+
+  if(args.trace)
+    error = write_trace(args.trace) || error;
+  stop_trace();
+
+  if(args.memory_stats)
+    print_memory_stats(stderr);
 
   if(file != stdin && file != NULL) {
     if(fclose(file) != 0) {
@@ -0,0 +1,548 @@
+#include "members.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "keywords.h"
+#include "syntax.h"
+#include "tokenize.h"
+
+// Lightweight type resolution for member accesses. Types are referenced by
+// the first token of their declaration in the token stream. Names are not
+// scoped, so a name declared with different types resolves to unknown.
+
+typedef struct member_decl {
+  const char *name;
+  const token_node *type;
+  struct member_decl *next;
+} member_decl;
+
+struct struct_decl {
+  const char *name;
+  member_decl *members;
+  struct struct_decl *next;
+};
+
+typedef enum type_kind {
+  TYPE_UNKNOWN,
+  TYPE_OTHER, // Scalar, vector, matrix or any other non-struct type
+  TYPE_STRUCT,
+  TYPE_ARRAY,
+} type_kind;
+
+typedef struct type_ref {
+  type_kind kind;
+  struct_decl *decl;         // TYPE_STRUCT
+  const token_node *element; // TYPE_ARRAY
+} type_ref;
+
+typedef struct name_decl {
+  const token_node *type; // Explicit type or return type (may be NULL)
+  const token_node *init; // Last token of the initializer (may be NULL)
+  struct name_decl *next; // Previous declaration of the same name
+} name_decl;
+
+// Declarations of a name, the type they agree on is resolved once
+typedef struct name_slot {
+  const char *name; // NULL for empty slots
+  name_decl *last;
+  struct_decl *decl; // Last struct declared with the name
+  bool resolving;
+  bool resolved;
+  type_ref ref;
+} name_slot;
+
+typedef struct name_index {
+  name_slot *slots;
+  size_t size; // Power of two
+  size_t used;
+} name_index;
+
+typedef struct type_context {
+  struct_decl *structs;
+  name_index struct_names;
+  name_index values; // let, var, const, override and function parameters
+  name_index functions;
+  name_index aliases;
+} type_context;
+
+type_ref resolve_type(type_context *ctx, const token_node *type);
+type_ref resolve_expr(type_context *ctx, const token_node *last);
+
+size_t hash_decl_name(const char *name)
+{
+  size_t h = 14695981039346656037u;
+  while(*name)
+    h = (h ^ (unsigned char)*name++) * 1099511628211u;
+  return h;
+}
+
+// Slot of the name, an empty one if the name is not indexed
+name_slot *find_slot(const name_index *index, const char *name)
+{
+  size_t mask = index->size - 1;
+  size_t i = hash_decl_name(name) & mask;
+  while(index->slots[i].name && strcmp(index->slots[i].name, name) != 0)
+    i = (i + 1) & mask;
+  return &index->slots[i];
+}
+
+bool init_name_index(name_index *index, size_t size)
+{
+  index->slots = calloc(size, sizeof(*index->slots));
+  index->size = size;
+  index->used = 0;
+  if(!index->slots) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  return false;
+}
+
+// Slot of the name, added if it is not indexed yet. The index grows beyond
+// half load, so slots are only valid until the next name is added.
+name_slot *add_slot(name_index *index, const char *name)
+{
+  if(2 * (index->used + 1) > index->size) {
+    name_index grown;
+    if(init_name_index(&grown, 2 * index->size))
+      return NULL;
+    for(size_t i=0; i<index->size; i++)
+      if(index->slots[i].name)
+        *find_slot(&grown, index->slots[i].name) = index->slots[i];
+    grown.used = index->used;
+    free(index->slots);
+    *index = grown;
+  }
+
+  name_slot *slot = find_slot(index, name);
+  if(!slot->name) {
+    slot->name = name;
+    index->used++;
+  }
+  return slot;
+}
+
+void free_name_index(name_index *index)
+{
+  for(size_t i=0; index->slots && i<index->size; i++)
+    while(index->slots[i].last) {
+      name_decl *next = index->slots[i].last->next;
+      free(index->slots[i].last);
+      index->slots[i].last = next;
+    }
+  free(index->slots);
+  index->slots = NULL;
+}
+
+struct_decl *find_struct(type_context *ctx, const char *name)
+{
+  return find_slot(&ctx->struct_names, name)->decl;
+}
+
+bool same_type(type_context *ctx, type_ref a, type_ref b)
+{
+  if(a.kind == TYPE_ARRAY && b.kind == TYPE_ARRAY)
+    return a.element == b.element || same_type(ctx,
+        resolve_type(ctx, a.element), resolve_type(ctx, b.element));
+  return a.kind == b.kind && a.decl == b.decl;
+}
+
+type_ref unknown_type(void)
+{
+  return (type_ref){ TYPE_UNKNOWN, NULL, NULL };
+}
+
+type_ref other_type(void)
+{
+  return (type_ref){ TYPE_OTHER, NULL, NULL };
+}
+
+type_ref resolve_name_decl(type_context *ctx, const name_decl *decl)
+{
+  if(decl->type)
+    return resolve_type(ctx, decl->type);
+  if(decl->init)
+    return resolve_expr(ctx, decl->init);
+  return unknown_type();
+}
+
+// All declarations of a name need to agree on the type. Names referring to
+// themselves while being resolved are of unknown type.
+type_ref resolve_name(type_context *ctx, name_index *index, const char *name)
+{
+  name_slot *slot = find_slot(index, name);
+  if(!slot->name || slot->resolving)
+    return unknown_type();
+  if(slot->resolved)
+    return slot->ref;
+
+  slot->resolving = true;
+  type_ref ref = resolve_name_decl(ctx, slot->last);
+  for(name_decl *decl = slot->last->next; decl; decl = decl->next)
+    if(!same_type(ctx, ref, resolve_name_decl(ctx, decl))) {
+      ref = unknown_type();
+      break;
+    }
+  // Resolving other names does not add slots, the slot is still valid
+  slot->resolving = false;
+  slot->resolved = true;
+  slot->ref = ref;
+
+  return ref;
+}
+
+type_ref resolve_type(type_context *ctx, const token_node *type)
+{
+  if(!type)
+    return unknown_type();
+
+  if(type->type == IDENTIFIER) {
+    struct_decl *s = find_struct(ctx, node_value(type));
+    if(s)
+      return (type_ref){ TYPE_STRUCT, s, NULL };
+    return resolve_name(ctx, &ctx->aliases, node_value(type));
+  }
+
+  if(is_kw(type, "array")) {
+    const token_node *element = template_arg(type, 0);
+    return element ? (type_ref){ TYPE_ARRAY, NULL, element } : unknown_type();
+  }
+
+  if(is_kw(type, "ptr"))
+    return resolve_type(ctx, template_arg(type, 1));
+
+  return type->type == KEYWORD ? other_type() : unknown_type();
+}
+
+type_ref member_type(type_context *ctx, type_ref base, const char *name)
+{
+  if(base.kind == TYPE_STRUCT) {
+    for(member_decl *m = base.decl->members; m; m = m->next)
+      if(strcmp(m->name, name) == 0)
+        return resolve_type(ctx, m->type);
+    return unknown_type();
+  }
+
+  // Swizzles of vectors are vectors or scalars again
+  return base.kind == TYPE_OTHER ? other_type() : unknown_type();
+}
+
+// Keywords followed by a parenthesized expression rather than a call
+bool is_statement_keyword(const token_node *node)
+{
+  return is_kw(node, "return") || is_kw(node, "if") || is_kw(node, "while") ||
+    is_kw(node, "switch") || is_kw(node, "case") ||
+    is_kw(node, "const_assert");
+}
+
+type_ref resolve_call(type_context *ctx, const token_node *open,
+    const token_node *close)
+{
+  const token_node *callee = prev_sig(open);
+  if(!callee)
+    return unknown_type();
+
+  if(callee->type == IDENTIFIER) {
+    const char *name = node_value(callee);
+    if(find_struct(ctx, name))
+      return resolve_type(ctx, callee);
+    name_decl *fn = find_slot(&ctx->functions, name)->last;
+    if(fn)
+      return fn->type ? resolve_type(ctx, fn->type) : other_type();
+    return resolve_name(ctx, &ctx->aliases, name);
+  }
+
+  if(callee->type == KEYWORD && is_statement_keyword(callee))
+    return resolve_expr(ctx, prev_sig(close));
+
+  if(callee->type == KEYWORD) {
+    // Built-ins returning built-in structs or their argument type, array
+    // constructors and functions named like reserved words
+    const char *name = node_value(callee);
+    if(!is_builtin_value(name) || strcmp(name, "frexp") == 0 ||
+        strcmp(name, "modf") == 0 ||
+        strcmp(name, "atomicCompareExchangeWeak") == 0 ||
+        strcmp(name, "workgroupUniformLoad") == 0 ||
+        strcmp(name, "array") == 0)
+      return unknown_type();
+    return other_type();
+  }
+
+  if(template_delta(callee) < 0) {
+    // Templated constructor or built-in, e.g. vec3<f32>(...)
+    const token_node *type = prev_sig(find_template_open(callee));
+    return type ? resolve_type(ctx, type) : unknown_type();
+  }
+
+  // Parenthesized expression
+  return resolve_expr(ctx, prev_sig(close));
+}
+
+type_ref resolve_expr(type_context *ctx, const token_node *last)
+{
+  if(!last)
+    return unknown_type();
+
+  switch(last->type) {
+    case IDENTIFIER: {
+      const token_node *p = prev_sig(last);
+      if(is_sym(p, "."))
+        return member_type(ctx, resolve_expr(ctx, prev_sig(p)), node_value(last));
+      return resolve_name(ctx, &ctx->values, node_value(last));
+    }
+    case KEYWORD:
+      // Parameters may be named like reserved words
+      if(find_slot(&ctx->values, node_value(last))->name)
+        return resolve_name(ctx, &ctx->values, node_value(last));
+      return is_kw(last, "true") || is_kw(last, "false") ?
+        other_type() : unknown_type();
+    case LITERAL:
+      return other_type();
+    case SYMBOL:
+      if(is_sym(last, "]")) {
+        const token_node *open = find_open(last, "[", "]");
+        type_ref base = resolve_expr(ctx, prev_sig(open));
+        if(base.kind == TYPE_ARRAY)
+          return resolve_type(ctx, base.element);
+        // Vectors and matrices
+        return base.kind == TYPE_OTHER ? other_type() : unknown_type();
+      }
+      if(is_sym(last, ")")) {
+        const token_node *open = find_open(last, "(", ")");
+        return open ? resolve_call(ctx, open, last) : unknown_type();
+      }
+      return unknown_type();
+    default:
+      return unknown_type();
+  }
+}
+
+bool add_name_decl(name_index *index, const char *name, const token_node *type,
+    const token_node *init)
+{
+  name_decl *decl = malloc(sizeof(*decl));
+  name_slot *slot = decl ? add_slot(index, name) : NULL;
+  if(!slot) {
+    if(!decl)
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(decl);
+    return true;
+  }
+
+  *decl = (name_decl){ type, init, slot->last };
+  slot->last = decl;
+
+  return false;
+}
+
+void free_struct_decls(struct_decl *first)
+{
+  while(first) {
+    struct_decl *next = first->next;
+    while(first->members) {
+      member_decl *m = first->members->next;
+      free(first->members);
+      first->members = m;
+    }
+    free(first);
+    first = next;
+  }
+}
+
+// Returns the last token of an expression terminated by ';' or an unbalanced
+// closing bracket
+const token_node *find_expr_end(const token_node *first)
+{
+  const token_node *last = NULL;
+  int depth = 0;
+  for(const token_node *curr = first; curr; curr = next_sig(curr)) {
+    if(is_sym(curr, "(") || is_sym(curr, "[") || is_sym(curr, "{"))
+      depth++;
+    else if(is_sym(curr, ")") || is_sym(curr, "]") || is_sym(curr, "}"))
+      depth--;
+    if(depth < 0 || (depth == 0 && (is_sym(curr, ";") || is_sym(curr, ","))))
+      break;
+    last = curr;
+  }
+  return last;
+}
+
+bool collect_struct(type_context *ctx, token_node *keyword)
+{
+  token_node *name = (token_node *)next_sig(keyword);
+  if(!name || name->type != IDENTIFIER || !is_sym(next_sig(name), "{"))
+    return false;
+
+  struct_decl *s = malloc(sizeof(*s));
+  if(!s) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  *s = (struct_decl){ node_value(name), NULL, ctx->structs };
+  ctx->structs = s;
+  name_slot *slot = add_slot(&ctx->struct_names, s->name);
+  if(!slot)
+    return true;
+  slot->decl = s;
+
+  member_decl **last = &s->members;
+  token_node *m = (token_node *)next_sig(next_sig(name));
+  while(m && !is_sym(m, "}")) {
+    m = (token_node *)skip_attributes(m);
+    // Some built-in value names like position are tokenized as keyword
+    if(!m || (m->type != IDENTIFIER && m->type != KEYWORD) ||
+        !is_sym(next_sig(m), ":"))
+      break;
+
+    member_decl *member = malloc(sizeof(*member));
+    if(!member) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      return true;
+    }
+    const token_node *type = next_sig(next_sig(m));
+    *member = (member_decl){ node_value(m), type, NULL };
+    *last = member;
+    last = &member->next;
+
+    if(m->type == IDENTIFIER) {
+      identifier_token *t = (identifier_token *)m->token;
+      t->access = MEMBER;
+      t->owner = s;
+    }
+
+    m = (token_node *)skip_type(type);
+    if(is_sym(m, ","))
+      m = (token_node *)next_sig(m);
+  }
+
+  return false;
+}
+
+bool collect_value(type_context *ctx, const token_node *keyword)
+{
+  const token_node *name = next_sig(keyword);
+  if(is_kw(keyword, "var") && is_sym(name, "<"))
+    name = skip_type(keyword);
+  if(!name || name->type != IDENTIFIER)
+    return false;
+
+  const token_node *type = NULL, *init = NULL;
+  const token_node *curr = next_sig(name);
+  if(is_sym(curr, ":")) {
+    type = next_sig(curr);
+    curr = skip_type(type);
+  }
+  if(is_sym(curr, "="))
+    init = find_expr_end(next_sig(curr));
+
+  return add_name_decl(&ctx->values, node_value(name), type, init);
+}
+
+bool collect_function(type_context *ctx, const token_node *keyword)
+{
+  const token_node *name = next_sig(keyword);
+  const token_node *open = next_sig(name);
+  if(!name || name->type != IDENTIFIER || !is_sym(open, "("))
+    return false;
+
+  const token_node *curr = next_sig(open);
+  while(curr && !is_sym(curr, ")")) {
+    curr = skip_attributes(curr);
+    if(!curr || (curr->type != IDENTIFIER && curr->type != KEYWORD) ||
+        !is_sym(next_sig(curr), ":"))
+      break;
+    const token_node *type = next_sig(next_sig(curr));
+    if(add_name_decl(&ctx->values, node_value(curr), type, NULL))
+      return true;
+    curr = skip_type(type);
+    if(is_sym(curr, ","))
+      curr = next_sig(curr);
+  }
+
+  const token_node *type = NULL;
+  if(is_sym(curr, ")") && is_sym(next_sig(curr), "->"))
+    type = skip_attributes(next_sig(next_sig(curr)));
+
+  return add_name_decl(&ctx->functions, node_value(name), type, NULL);
+}
+
+bool collect_alias(type_context *ctx, const token_node *keyword)
+{
+  const token_node *name = next_sig(keyword);
+  if(!name || name->type != IDENTIFIER || !is_sym(next_sig(name), "="))
+    return false;
+  return add_name_decl(&ctx->aliases, node_value(name), next_sig(next_sig(name)), NULL);
+}
+
+bool collect_decls(type_context *ctx, token_node *head)
+{
+  bool error = false;
+  for(token_node *curr = head; !error && curr; curr = curr->next) {
+    if(curr->type != KEYWORD)
+      continue;
+    if(is_kw(curr, "struct"))
+      error = collect_struct(ctx, curr);
+    else if(is_kw(curr, "let") || is_kw(curr, "var") ||
+        is_kw(curr, "const") || is_kw(curr, "override"))
+      error = collect_value(ctx, curr);
+    else if(is_kw(curr, "fn"))
+      error = collect_function(ctx, curr);
+    else if(is_kw(curr, "alias"))
+      error = collect_alias(ctx, curr);
+  }
+  return error;
+}
+
+void classify_access(type_context *ctx, token_node *node)
+{
+  identifier_token *t = (identifier_token *)node->token;
+  const token_node *dot = prev_sig(node);
+  if(!is_sym(dot, "."))
+    return;
+
+  type_ref base = resolve_expr(ctx, prev_sig(dot));
+  t->access = UNRESOLVED_MEMBER;
+  if(base.kind == TYPE_STRUCT) {
+    for(member_decl *m = base.decl->members; m; m = m->next)
+      if(strcmp(m->name, t->value) == 0) {
+        t->access = MEMBER;
+        t->owner = base.decl;
+        break;
+      }
+  } else if(base.kind == TYPE_OTHER)
+    t->access = SWIZZLE;
+}
+
+bool classify_identifiers(token_node *head, struct_decl **structs)
+{
+  for(token_node *curr = head; curr; curr = curr->next)
+    if(curr->type == IDENTIFIER) {
+      ((identifier_token *)curr->token)->access = PLAIN;
+      ((identifier_token *)curr->token)->owner = NULL;
+    }
+
+  type_context ctx = { NULL, { NULL, 0, 0 }, { NULL, 0, 0 }, { NULL, 0, 0 },
+    { NULL, 0, 0 } };
+  bool error = init_name_index(&ctx.struct_names, 64) ||
+    init_name_index(&ctx.values, 64) || init_name_index(&ctx.functions, 64) ||
+    init_name_index(&ctx.aliases, 64) || collect_decls(&ctx, head);
+
+  for(token_node *curr = head; !error && curr; curr = curr->next)
+    if(curr->type == IDENTIFIER &&
+        ((identifier_token *)curr->token)->access != MEMBER)
+      classify_access(&ctx, curr);
+
+  free_name_index(&ctx.struct_names);
+  free_name_index(&ctx.values);
+  free_name_index(&ctx.functions);
+  free_name_index(&ctx.aliases);
+
+  if(error) {
+    free_struct_decls(ctx.structs);
+    ctx.structs = NULL;
+  }
+  *structs = ctx.structs;
+
+  return error;
+}
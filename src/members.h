@@ -0,0 +1,16 @@
+#ifndef MEMBERS_H
+#define MEMBERS_H
+
+#include <stdbool.h>
+
+typedef struct token_node token_node;
+typedef struct struct_decl struct_decl;
+
+// Classifies every identifier token as plain name, struct member (declared
+// or accessed on a value of known struct type), swizzle or member access on a
+// value of unknown type. Member tokens reference their struct_decl, which
+// stays valid until free_struct_decls() is called.
+bool classify_identifiers(token_node *head, struct_decl **structs);
+void free_struct_decls(struct_decl *first);
+
+#endif
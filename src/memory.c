@@ -0,0 +1,115 @@
+#include "memory.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Typical per allocation overhead of malloc implementations
+#define ALLOC_OVERHEAD (2 * sizeof(size_t))
+
+const char *mem_subsystem_names[MEM_SUBSYSTEM_COUNT] = {
+  "source",
+  "tokens",
+  "identifiers",
+};
+
+atomic_size_t mem_live[MEM_SUBSYSTEM_COUNT];
+atomic_size_t mem_peak[MEM_SUBSYSTEM_COUNT];
+atomic_size_t mem_total_live;
+atomic_size_t mem_total_peak;
+atomic_bool mem_limit_reported;
+size_t mem_limit;
+
+void update_peak(atomic_size_t *peak, size_t value)
+{
+  size_t curr = atomic_load(peak);
+  while(curr < value && !atomic_compare_exchange_weak(peak, &curr, value))
+    ;
+}
+
+// Accounts size more bytes, fails if this exceeds the limit
+bool reserve_memory(mem_subsystem subsystem, size_t size)
+{
+  size_t total = atomic_fetch_add(&mem_total_live, size) + size;
+  if(mem_limit > 0 && total > mem_limit) {
+    atomic_fetch_sub(&mem_total_live, size);
+    if(!atomic_exchange(&mem_limit_reported, true))
+      fprintf(stderr, "Memory limit of %zu bytes exceeded\n", mem_limit);
+    errno = ENOMEM;
+    return true;
+  }
+
+  size_t live = atomic_fetch_add(&mem_live[subsystem], size) + size;
+  update_peak(&mem_peak[subsystem], live);
+  update_peak(&mem_total_peak, total);
+
+  return false;
+}
+
+void release_memory(mem_subsystem subsystem, size_t size)
+{
+  atomic_fetch_sub(&mem_live[subsystem], size);
+  atomic_fetch_sub(&mem_total_live, size);
+}
+
+void *mem_alloc(mem_subsystem subsystem, size_t size)
+{
+  if(reserve_memory(subsystem, size + ALLOC_OVERHEAD))
+    return NULL;
+
+  void *ptr = malloc(size);
+  if(!ptr)
+    release_memory(subsystem, size + ALLOC_OVERHEAD);
+
+  return ptr;
+}
+
+void *mem_realloc(mem_subsystem subsystem, void *ptr, size_t old_size,
+    size_t size)
+{
+  size_t old_cost = ptr ? old_size + ALLOC_OVERHEAD : 0;
+  size_t cost = size + ALLOC_OVERHEAD;
+  if(cost > old_cost && reserve_memory(subsystem, cost - old_cost))
+    return NULL;
+
+  void *res = realloc(ptr, size);
+  if(!res && cost > old_cost)
+    release_memory(subsystem, cost - old_cost);
+  else if(res && cost < old_cost)
+    release_memory(subsystem, old_cost - cost);
+
+  return res;
+}
+
+char *mem_strndup(mem_subsystem subsystem, const char *src, size_t len)
+{
+  char *dst = mem_alloc(subsystem, len + 1);
+  if(dst) {
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+  }
+  return dst;
+}
+
+void mem_free(mem_subsystem subsystem, void *ptr, size_t size)
+{
+  if(ptr) {
+    release_memory(subsystem, size + ALLOC_OVERHEAD);
+    free(ptr);
+  }
+}
+
+void set_memory_limit(size_t limit)
+{
+  mem_limit = limit;
+}
+
+void print_memory_stats(FILE *file)
+{
+  fprintf(file, "%-12s %12s %12s\n", "Memory", "live", "peak");
+  for(size_t i=0; i<MEM_SUBSYSTEM_COUNT; i++)
+    fprintf(file, "%-12s %12zu %12zu\n", mem_subsystem_names[i],
+        atomic_load(&mem_live[i]), atomic_load(&mem_peak[i]));
+  fprintf(file, "%-12s %12zu %12zu\n", "total", atomic_load(&mem_total_live),
+      atomic_load(&mem_total_peak));
+}
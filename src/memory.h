@@ -0,0 +1,28 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum mem_subsystem {
+  MEM_SOURCE,      // Input text
+  MEM_TOKENS,      // Token nodes, tokens and their values
+  MEM_IDENTIFIERS, // Identifier tables of the mangler
+  MEM_SUBSYSTEM_COUNT,
+} mem_subsystem;
+
+// Accounted allocations. Each allocation is counted with its size plus an
+// estimate of the allocator overhead. The size passed to mem_free() has to
+// match the allocated size. Allocations fail with ENOMEM once the total
+// would exceed the limit set by set_memory_limit().
+void *mem_alloc(mem_subsystem subsystem, size_t size);
+void *mem_realloc(mem_subsystem subsystem, void *ptr, size_t old_size,
+    size_t size);
+char *mem_strndup(mem_subsystem subsystem, const char *src, size_t len);
+void mem_free(mem_subsystem subsystem, void *ptr, size_t size);
+
+void set_memory_limit(size_t limit);
+void print_memory_stats(FILE *file);
+
+#endif
@@ -1,12 +1,22 @@
 #include "minify.h"
-#include <ctype.h>
 #include <errno.h>
-#include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "buffer.h"
-#include "keywords.h"
+#include "charclass.h"
+#include "estimate.h"
+#include "members.h"
+#include "memory.h"
+#include "parallel.h"
+#include "syntax.h"
 #include "tokenize.h"
+#include "trace.h"
+
+typedef struct alphabet {
+  const char *first; // Characters of the first position
+  const char *rest;  // Characters of all other positions
+} alphabet;
 
 typedef struct identifier {
   char *value;
@@ -15,6 +25,21 @@ typedef struct identifier {
   struct identifier *next;
 } identifier;
 
+typedef struct member_ref {
+  const identifier_token *token;
+  struct member_ref *next;
+} member_ref;
+
+// Members of a struct are named independently of all other structs
+typedef struct member_scope {
+  void *owner;       // Struct declaration
+  identifier *first; // Members mangled within the struct
+  member_ref *fixed; // Members named globally or not mangled at all
+  struct member_scope *next;
+} member_scope;
+
+void free_identifiers(identifier *first);
+
 token_node* delete_node(token_node *node)
 {
   if(node->prev)
@@ -35,11 +60,13 @@ void remove_comments(token_node **head)
   while(curr) {
     if(curr->type == COMMENT) {
       curr = delete_node(curr);
-      if(!curr || !curr->prev)
+      if(!curr || !curr->prev) {
+        // Node following the deleted head needs to be checked as well
         *head = curr;
+        continue;
+      }
     }
-    if(curr)
-      curr = curr->next;
+    curr = curr->next;
   }
 }
 
@@ -54,11 +81,13 @@ void compress_whitespaces(token_node **head)
           (curr->prev &&
           (curr->prev->type == WHITESPACE || curr->prev->type == SYMBOL))))) {
       curr = delete_node(curr);
-      if(!curr || !curr->prev)
+      if(!curr || !curr->prev) {
+        // Node following the deleted head needs to be checked as well
         *head = curr;
+        continue;
+      }
     }
-    if(curr)
-      curr = curr->next;
+    curr = curr->next;
   }
 }
 
@@ -67,8 +96,8 @@ char *omit_leading_zeros(char *value)
   size_t len = strlen(value);
   size_t i = 0;
   while(i < len - 1 && value[i] == '0') {
-    if(i + 1 <= len - 1 && isdigit(value[i + 1]) == 0 &&
-      !(value[i + 1] == '.' && i + 2 <= len - 1 && isdigit(value[i + 2]) != 0))
+    if(i + 1 <= len - 1 && !has_class(value[i + 1], CC_DIGIT) &&
+      !(value[i + 1] == '.' && i + 2 <= len - 1 && has_class(value[i + 2], CC_DIGIT)))
       // 0u, 0i, 0.e+4f, 0e+4f, 0h, 0f, 0.h, 0.f
       break;
     i++;
@@ -100,12 +129,7 @@ bool compress_literals(token_node *head)
       if(strchr(value, 'x') == NULL && strchr(value, 'X') == NULL) {  
         char *value_new = omit_leading_zeros(value);
         if(value_new != value) {
-          ((token *)curr->token)->value = strdup(value_new);
-          if(!((token *)curr->token)->value) {
-            fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
-            error = true;
-          }
-          free(value);
+          error = set_token_value(curr, value_new, strlen(value_new));
           value = ((token *)curr->token)->value;
         } 
         
@@ -113,15 +137,8 @@ bool compress_literals(token_node *head)
           continue;
 
         value_new = omit_trailing_zeros(value);
-        if(value_new != value) {
-          *value_new = '\0';
-          ((token *)curr->token)->value = strdup(value);
-          if(!((token *)curr->token)->value) {
-            fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
-            error = true;
-          }
-          free(value);
-        }
+        if(value_new != value)
+          error = set_token_value(curr, value, value_new - value);
       }
     }
     curr = curr->next;
@@ -132,9 +149,16 @@ bool compress_literals(token_node *head)
 
 bool minify(token_node **head)
 {
+  uint64_t begin = trace_begin();
   remove_comments(head);
+  trace_end("remove_comments", begin);
+  begin = trace_begin();
   compress_whitespaces(head);
-  return compress_literals(*head);
+  trace_end("compress_whitespaces", begin);
+  begin = trace_begin();
+  bool error = compress_literals(*head);
+  trace_end("compress_literals", begin);
+  return error;
 }
 
 void move_identifier(identifier *nominee, identifier *next)
@@ -164,7 +188,7 @@ identifier *add_identifier(identifier **first, const char *value)
   }
 
   if(!curr) {
-    curr = malloc(sizeof(*curr));
+    curr = mem_alloc(MEM_IDENTIFIERS, sizeof(*curr));
     if(!curr) {
       fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
       return NULL;
@@ -173,7 +197,7 @@ identifier *add_identifier(identifier **first, const char *value)
     curr->value = strdup(value);
     if(!curr->value) {
       fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
-      free(curr);
+      mem_free(MEM_IDENTIFIERS, curr, sizeof(*curr));
       return NULL;
     }
 
@@ -227,96 +251,1257 @@ bool is_swizzle_name(const char *name)
   return false;
 }
 
-bool is_excluded(const char *name, const char **exclude_names, size_t exclude_count)
+identifier *find_identifier(identifier *first, const char *value)
+{
+  while(first && strcmp(first->value, value) != 0)
+    first = first->next;
+  return first;
+}
+
+// Collects the names of all accesses not resolved to a struct member.
+// Members are only named per struct if no access of their name is listed,
+// as a swizzle may be a misresolved member access as well.
+bool create_unresolved_member_list(identifier **first, token_node *head)
 {
-  for(size_t i=0; i<exclude_count; i++)
-    if(strcmp(name, exclude_names[i]) == 0)
+  for(token_node *curr = head; curr; curr = curr->next) {
+    if(curr->type != IDENTIFIER)
+      continue;
+    const identifier_token *t = (identifier_token *)curr->token;
+    if((t->access == UNRESOLVED_MEMBER || t->access == SWIZZLE) &&
+        !add_identifier(first, t->value))
       return true;
+  }
+
   return false;
 }
 
-bool create_identifier_list(identifier **first, token_node *head,
-    const char **exclude_names, size_t exclude_count)
+member_scope *add_member_scope(member_scope **first, void *owner)
+{
+  member_scope *curr = *first;
+  while(curr && curr->owner != owner)
+    curr = curr->next;
+
+  if(!curr) {
+    curr = malloc(sizeof(*curr));
+    if(!curr) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      return NULL;
+    }
+    *curr = (member_scope){ owner, NULL, NULL, *first };
+    *first = curr;
+  }
+
+  return curr;
+}
+
+const char *member_ref_value(const member_ref *ref)
+{
+  return ref->token->data ?
+    ((identifier *)ref->token->data)->value : ref->token->value;
+}
+
+bool add_member_ref(member_scope *scope, const identifier_token *token)
+{
+  for(member_ref *ref = scope->fixed; ref; ref = ref->next)
+    if(ref->token->data == token->data &&
+        strcmp(ref->token->value, token->value) == 0)
+      return false;
+
+  member_ref *ref = malloc(sizeof(*ref));
+  if(!ref) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  *ref = (member_ref){ token, scope->fixed };
+  scope->fixed = ref;
+
+  return false;
+}
+
+void free_member_scopes(member_scope *first)
+{
+  while(first) {
+    member_scope *next = first->next;
+    while(first->fixed) {
+      member_ref *ref = first->fixed->next;
+      free(first->fixed);
+      first->fixed = ref;
+    }
+    free_identifiers(first->first);
+    free(first);
+    first = next;
+  }
+}
+
+bool is_mangleable(const identifier_token *t)
 {
+  // Names like xy or rgb are mangled unless used as swizzle or as member of
+  // a struct with unresolved accesses.
+  return !is_swizzle_name(t->value) || t->access == PLAIN;
+}
+
+// Members whose accesses are all resolved go to the namespace of their struct,
+// all other mangled identifiers share the global namespace.
+// Returns whether the name of the token is mangled. Owner is set to the
+// struct declaration for names mangled per struct and to NULL otherwise.
+bool get_mangle_owner(const identifier_token *t,
+    const identifier *unresolved_members, const exclude_set *excludes,
+    void **owner)
+{
+  *owner = NULL;
+  if(is_excluded(t->value, excludes))
+    return false;
+  if(t->access == MEMBER && !find_identifier((identifier *)unresolved_members,
+        t->value)) {
+    *owner = t->owner;
+    return true;
+  }
+  return is_mangleable(t);
+}
+
+// Remembers the member names of each scope that are named otherwise
+bool add_fixed_member_refs(member_scope *scopes, token_node *head,
+    const identifier *unresolved_members)
+{
+  bool error = false;
+  for(token_node *curr = head; !error && curr; curr = curr->next) {
+    if(curr->type != IDENTIFIER)
+      continue;
+    identifier_token *t = (identifier_token *)curr->token;
+    if(t->access != MEMBER || (t->data && find_identifier(
+        (identifier *)unresolved_members, t->value) == NULL))
+      continue;
+    for(member_scope *scope = scopes; scope; scope = scope->next)
+      if(scope->owner == t->owner) {
+        error = add_member_ref(scope, t);
+        break;
+      }
+  }
+
+  return error;
+}
+
+bool create_identifier_list(identifier **first, member_scope **scopes,
+    token_node *head, const exclude_set *excludes)
+{
+  identifier *unresolved_members = NULL;
+  bool error = create_unresolved_member_list(&unresolved_members, head);
+
   token_node *curr = head;
-  while(curr) {
+  while(!error && curr) {
+    void *owner;
     if(curr->type == IDENTIFIER) {
-      const char *value = ((identifier_token *)curr->token)->value;
-      if(!is_swizzle_name(value) && // TODO Support non-struct vars with swizzle names
-          !is_excluded(value, exclude_names, exclude_count)) {
-        identifier *identifier = add_identifier(first, value);
-        if(!identifier)
-          return false;
-        ((identifier_token *)curr->token)->data = identifier;
+      identifier_token *t = (identifier_token *)curr->token;
+      if(get_mangle_owner(t, unresolved_members, excludes,
+            &owner)) {
+        identifier **list = first;
+        if(owner) {
+          member_scope *scope = add_member_scope(scopes, owner);
+          list = scope ? &scope->first : NULL;
+          error = !scope;
+        }
+
+        if(list) {
+          identifier *identifier = add_identifier(list, t->value);
+          error = !identifier;
+          t->data = identifier;
+        }
       }
     }
     curr = curr->next;
   }
 
+  if(!error)
+    error = add_fixed_member_refs(*scopes, head, unresolved_members);
+
+  free_identifiers(unresolved_members);
+
+  return error;
+}
+
+// Occurrences of a name within one scope, used by the parallel path
+typedef struct name_entry {
+  const char *name; // Token value, NULL for empty slots
+  void *owner;      // Struct declaration of member scoped names
+  size_t count;
+  size_t first;     // Token index of the first and last occurrence
+  size_t last;
+  size_t scope_first; // First occurrence of any name of the owner
+  identifier *id;
+} name_entry;
+
+typedef struct name_table {
+  name_entry *entries;
+  size_t size; // Power of two
+  size_t used;
+} name_table;
+
+typedef struct count_task {
+  token_node *start;
+  token_node *end; // Exclusive
+  size_t index;    // Token index of start
+  const identifier *unresolved_members;
+  const exclude_set *excludes;
+  const name_table *names; // Merged table for assigning identifiers
+  name_table table;
+  bool error;
+} count_task;
+
+// Minimum number of tokens per thread of the parallel path
+#define MIN_TOKENS_PER_TASK 16384
+
+size_t hash_name(const char *name, const void *owner)
+{
+  size_t h = 14695981039346656037u;
+  while(*name)
+    h = (h ^ (unsigned char)*name++) * 1099511628211u;
+  return h ^ (size_t)(uintptr_t)owner;
+}
+
+name_entry *find_name_entry(const name_table *table, const char *name,
+    const void *owner)
+{
+  size_t mask = table->size - 1;
+  size_t i = hash_name(name, owner) & mask;
+  while(table->entries[i].name && (table->entries[i].owner != owner ||
+        strcmp(table->entries[i].name, name) != 0))
+    i = (i + 1) & mask;
+  return &table->entries[i];
+}
+
+bool init_name_table(name_table *table, size_t size)
+{
+  table->entries = mem_alloc(MEM_IDENTIFIERS, size * sizeof(*table->entries));
+  table->size = size;
+  table->used = 0;
+  if(!table->entries) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  memset(table->entries, 0, size * sizeof(*table->entries));
+  return false;
+}
+
+void free_name_table(name_table *table)
+{
+  mem_free(MEM_IDENTIFIERS, table->entries,
+      table->size * sizeof(*table->entries));
+  table->entries = NULL;
+}
+
+// Adds the occurrences of a name, growing the table beyond half load
+bool merge_name_entry(name_table *table, const name_entry *add)
+{
+  if(2 * (table->used + 1) > table->size) {
+    name_table grown;
+    if(init_name_table(&grown, 2 * table->size))
+      return true;
+    for(size_t i=0; i<table->size; i++)
+      if(table->entries[i].name)
+        *find_name_entry(&grown, table->entries[i].name,
+            table->entries[i].owner) = table->entries[i];
+    grown.used = table->used;
+    free_name_table(table);
+    *table = grown;
+  }
+
+  name_entry *entry = find_name_entry(table, add->name, add->owner);
+  if(!entry->name) {
+    *entry = *add;
+    table->used++;
+  } else {
+    entry->count += add->count;
+    entry->first = add->first < entry->first ? add->first : entry->first;
+    entry->last = add->last > entry->last ? add->last : entry->last;
+  }
+
+  return false;
+}
+
+int count_names(void *arg)
+{
+  uint64_t begin = trace_begin();
+  count_task *task = arg;
+  size_t index = task->index;
+  task->error = init_name_table(&task->table, 64);
+  for(token_node *curr = task->start; !task->error && curr != task->end;
+      curr = curr->next, index++) {
+    void *owner;
+    if(curr->type == IDENTIFIER && get_mangle_owner(curr->token,
+          task->unresolved_members, task->excludes,
+          &owner)) {
+      name_entry add = { ((identifier_token *)curr->token)->value, owner, 1,
+        index, index, 0, NULL };
+      task->error = merge_name_entry(&task->table, &add);
+    }
+  }
+  trace_end("count_names", begin);
+  return 0;
+}
+
+int assign_identifiers(void *arg)
+{
+  uint64_t begin = trace_begin();
+  count_task *task = arg;
+  for(token_node *curr = task->start; curr != task->end; curr = curr->next) {
+    void *owner;
+    if(curr->type == IDENTIFIER && get_mangle_owner(curr->token,
+          task->unresolved_members, task->excludes,
+          &owner)) {
+      identifier_token *t = (identifier_token *)curr->token;
+      t->data = find_name_entry(task->names, t->value, owner)->id;
+    }
+  }
+  trace_end("assign_identifiers", begin);
+  return 0;
+}
+
+// Same order as add_identifier(): most occurrences first, ties in order of
+// the last occurrence. Member names are grouped by scope, scopes in order of
+// their first occurrence.
+int compare_name_entries(const void *a, const void *b)
+{
+  const name_entry *x = *(const name_entry * const *)a;
+  const name_entry *y = *(const name_entry * const *)b;
+  if(x->scope_first != y->scope_first)
+    return x->scope_first < y->scope_first ? -1 : 1;
+  if(x->count != y->count)
+    return x->count > y->count ? -1 : 1;
+  return x->last < y->last ? -1 : (x->last > y->last);
+}
+
+int compare_name_owners(const void *a, const void *b)
+{
+  const name_entry *x = *(const name_entry * const *)a;
+  const name_entry *y = *(const name_entry * const *)b;
+  uintptr_t p = (uintptr_t)x->owner, q = (uintptr_t)y->owner;
+  return p < q ? -1 : (p > q);
+}
+
+identifier *append_identifier(identifier **first, identifier *last,
+    const char *value, size_t count)
+{
+  identifier *id = mem_alloc(MEM_IDENTIFIERS, sizeof(*id));
+  if(!id) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return NULL;
+  }
+  id->value = strdup(value);
+  if(!id->value) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    mem_free(MEM_IDENTIFIERS, id, sizeof(*id));
+    return NULL;
+  }
+  id->count = count;
+  id->prev = last;
+  id->next = NULL;
+  if(last)
+    last->next = id;
+  else
+    *first = id;
+
+  return id;
+}
+
+// Builds the identifier list and member scopes from the merged table in the
+// order the serial path creates them
+bool create_lists_from_names(identifier **first, member_scope **scopes,
+    name_table *names)
+{
+  name_entry **sorted = malloc((names->used + 1) * sizeof(*sorted));
+  if(!sorted) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  size_t count = 0;
+  for(size_t i=0; i<names->size; i++)
+    if(names->entries[i].name)
+      sorted[count++] = &names->entries[i];
+
+  // Global names sort first, member scopes by their first occurrence
+  qsort(sorted, count, sizeof(*sorted), compare_name_owners);
+  for(size_t i=0, j=0; i<count; i = j) {
+    size_t scope_first = sorted[i]->first;
+    for(j = i; j < count && sorted[j]->owner == sorted[i]->owner; j++)
+      scope_first = sorted[j]->first < scope_first ? sorted[j]->first : scope_first;
+    for(size_t k=i; k<j; k++)
+      sorted[k]->scope_first = sorted[i]->owner ? scope_first + 1 : 0;
+  }
+  qsort(sorted, count, sizeof(*sorted), compare_name_entries);
+
+  bool error = false;
+  identifier *last = NULL;
+  member_scope *scope = NULL;
+  for(size_t i=0; !error && i<count; i++) {
+    name_entry *entry = sorted[i];
+    if(entry->owner && (!scope || scope->owner != entry->owner)) {
+      scope = add_member_scope(scopes, entry->owner);
+      last = NULL;
+      error = !scope;
+    }
+    if(!error) {
+      entry->id = append_identifier(scope ? &scope->first : first, last,
+          entry->name, entry->count);
+      last = entry->id;
+      error = !entry->id;
+    }
+  }
+
+  free(sorted);
+
+  return error;
+}
+
+// Splits the token list into at most count ranges of similar length
+size_t split_tokens(token_node *head, count_task *tasks, size_t count)
+{
+  size_t len = 0;
+  for(token_node *curr = head; curr; curr = curr->next)
+    len++;
+  if(count > len / MIN_TOKENS_PER_TASK)
+    count = len / MIN_TOKENS_PER_TASK;
+  if(count < 1)
+    count = 1;
+
+  size_t n = 0, index = 0;
+  for(token_node *curr = head; curr; curr = curr->next, index++)
+    if(index == n * (len / count) && n < count) {
+      if(n > 0)
+        tasks[n - 1].end = curr;
+      tasks[n].start = curr;
+      tasks[n].index = index;
+      tasks[n].end = NULL;
+      n++;
+    }
+
+  return n;
+}
+
+// Parallel version of create_identifier_list() with identical results.
+// Names are counted per thread, merged and sorted, then the identifiers are
+// assigned to the tokens in parallel again.
+bool create_identifier_list_parallel(identifier **first, member_scope **scopes,
+    token_node *head, const exclude_set *excludes, size_t threads)
+{
+  identifier *unresolved_members = NULL;
+  bool error = create_unresolved_member_list(&unresolved_members, head);
+
+  count_task *tasks = calloc(threads, sizeof(*tasks));
+  if(!tasks) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free_identifiers(unresolved_members);
+    return true;
+  }
+
+  size_t count = error || !head ? 0 : split_tokens(head, tasks, threads);
+  for(size_t i=0; i<count; i++) {
+    tasks[i].unresolved_members = unresolved_members;
+    tasks[i].excludes = excludes;
+  }
+  run_tasks(count_names, tasks, sizeof(*tasks), count);
+
+  name_table names = { NULL, 0, 0 };
+  error = error || init_name_table(&names, 64);
+  for(size_t i=0; i<count; i++) {
+    error = error || tasks[i].error;
+    for(size_t j=0; !error && j<tasks[i].table.size; j++)
+      if(tasks[i].table.entries[j].name)
+        error = merge_name_entry(&names, &tasks[i].table.entries[j]);
+  }
+
+  if(!error)
+    error = create_lists_from_names(first, scopes, &names);
+
+  if(!error) {
+    for(size_t i=0; i<count; i++)
+      tasks[i].names = &names;
+    run_tasks(assign_identifiers, tasks, sizeof(*tasks), count);
+    error = add_fixed_member_refs(*scopes, head, unresolved_members);
+  }
+
+  for(size_t i=0; i<count; i++)
+    free_name_table(&tasks[i].table);
+  free(tasks);
+  free_name_table(&names);
+  free_identifiers(unresolved_members);
+
+  return error;
+}
+
+// Function or struct declaration at module scope
+typedef struct declaration {
+  token_node *first; // First attribute or the keyword
+  token_node *last;  // Closing brace
+  token_node *name;
+  bool entry_point;
+  char *shape;       // Token sequence with local names numbered
+} declaration;
+
+typedef struct declaration_list {
+  declaration *decls;
+  size_t count;
+  size_t capacity;
+} declaration_list;
+
+bool add_declaration(declaration_list *list, const declaration *decl)
+{
+  if(list->count == list->capacity) {
+    size_t capacity = list->capacity ? 2 * list->capacity : 64;
+    declaration *decls = realloc(list->decls, capacity * sizeof(*decls));
+    if(!decls) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      return true;
+    }
+    list->decls = decls;
+    list->capacity = capacity;
+  }
+  list->decls[list->count++] = *decl;
   return false;
 }
 
-char *eval_name(size_t cnt)
+void free_declarations(declaration_list *list)
 {
-  const size_t max_char = 26;
+  for(size_t i=0; i<list->count; i++)
+    free(list->decls[i].shape);
+  free(list->decls);
+  *list = (declaration_list){ NULL, 0, 0 };
+}
+
+bool add_name(name_table *table, const char *name, size_t index)
+{
+  name_entry add = { name, NULL, 1, index, index, 0, NULL };
+  return find_name_entry(table, name, NULL)->name ? false :
+    merge_name_entry(table, &add);
+}
+
+bool has_name(const name_table *table, const char *name)
+{
+  return find_name_entry(table, name, NULL)->name != NULL;
+}
+
+// Collects the function and struct declarations at module scope
+bool collect_declarations(token_node *head, declaration_list *list)
+{
+  bool error = false;
+  token_node *start = NULL;
+  for(token_node *curr = head; !error && curr;
+      curr = (token_node *)next_sig(curr)) {
+    if(curr->type == WHITESPACE || curr->type == COMMENT)
+      continue;
+    start = start ? start : curr;
+    if(is_sym(curr, ";")) {
+      start = NULL;
+      continue;
+    }
+    if(!is_kw(curr, "fn") && !is_kw(curr, "struct"))
+      continue;
+
+    token_node *name = (token_node *)next_sig(curr);
+    const token_node *open = name;
+    while(open && !is_sym(open, "{") && !is_sym(open, ";"))
+      open = next_sig(open);
+    token_node *close = (token_node *)find_close(open, "{", "}");
+    if(!is_sym(open, "{") || !close || !name || name->type != IDENTIFIER)
+      break;
+
+    declaration decl = { start, close, name, false, NULL };
+    for(const token_node *attr = start; attr != curr; attr = next_sig(attr))
+      if(is_kw(attr, "vertex") || is_kw(attr, "fragment") ||
+          is_kw(attr, "compute"))
+        decl.entry_point = true;
+    error = add_declaration(list, &decl);
+    curr = close;
+    start = NULL;
+  }
+
+  return error;
+}
+
+// Adds the names declared by let, var or const inside of braces or as
+// parameters from first up to and including last (NULL for all)
+bool collect_local_names(const token_node *first, const token_node *last,
+    name_table *locals)
+{
+  bool error = false;
+  int braces = 0, parens = 0;
+  for(const token_node *curr = first; !error && curr; curr = next_sig(curr)) {
+    braces += is_sym(curr, "{") - is_sym(curr, "}");
+    parens += is_sym(curr, "(") - is_sym(curr, ")");
+    const token_node *prev = prev_sig(curr);
+    if(curr->type == IDENTIFIER && ((braces > 0 && (is_kw(prev, "let") ||
+              is_kw(prev, "var") || is_kw(prev, "const"))) ||
+          (parens > 0 && is_sym(next_sig(curr), ":"))))
+      error = add_name(locals, node_value(curr), locals->used);
+    if(curr == last)
+      break;
+  }
+  return error;
+}
+
+// Renders the declaration with its own name replaced by '$' and its local
+// names numbered in order of declaration
+bool create_shape(declaration *decl)
+{
+  name_table locals;
+  bool error = init_name_table(&locals, 16) ||
+    collect_local_names(decl->first, decl->last, &locals);
+
+  buffer buf = { NULL, 0, 0 };
+  for(const token_node *curr = decl->first; !error; curr = next_sig(curr)) {
+    const char *value = node_value(curr);
+    char local[24];
+    if(curr == decl->name)
+      value = "$";
+    else if(curr->type == IDENTIFIER && !is_sym(prev_sig(curr), ".") &&
+        has_name(&locals, value)) {
+      snprintf(local, sizeof(local), "$%zu",
+          find_name_entry(&locals, value, NULL)->first);
+      value = local;
+    }
+    error = write_buf_str(&buf, value) || write_buf(&buf, ' ');
+    if(curr == decl->last)
+      break;
+  }
+
+  free_name_table(&locals);
+  if(error) {
+    free(buf.ptr);
+    return true;
+  }
+  decl->shape = buf_to_str(&buf, true);
+
+  return !decl->shape;
+}
+
+// Merges one round of identical declarations, the first one survives
+bool merge_declarations(token_node **head, const exclude_set *excludes,
+    bool *merged)
+{
+  declaration_list list = { NULL, 0, 0 };
+  name_table shapes, bound, renames;
+  bool error = init_name_table(&shapes, 64);
+  error = error || init_name_table(&bound, 64);
+  error = error || init_name_table(&renames, 64);
+  error = error || collect_declarations(*head, &list) ||
+    collect_local_names(*head, NULL, &bound);
+
+  // Names of removed declarations are copied, the tokens are freed first
+  char **removed = list.count ? calloc(list.count, sizeof(*removed)) : NULL;
+  if(!error && list.count && !removed) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    error = true;
+  }
+
+  for(size_t i=0; !error && i<list.count; i++) {
+    declaration *decl = &list.decls[i];
+    if(decl->entry_point)
+      continue;
+    error = create_shape(decl);
+    if(error)
+      break;
+    name_entry *same = find_name_entry(&shapes, decl->shape, NULL);
+    if(!same->name) {
+      error = add_name(&shapes, decl->shape, i);
+      continue;
+    }
+    const char *name = node_value(decl->name);
+    const char *survivor = node_value(list.decls[same->first].name);
+    if(is_excluded(name, excludes) || has_name(&bound, name) ||
+        has_name(&bound, survivor))
+      continue;
+    removed[i] = strdup(name);
+    error = !removed[i] || add_name(&renames, removed[i], same->first);
+    if(!removed[i])
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+  }
+
+  // References are renamed before the declarations are removed. Names of
+  // struct members are no references.
+  const token_node *struct_end = NULL;
+  for(token_node *curr = *head; !error && curr; curr = curr->next) {
+    if(is_kw(curr, "struct") && is_sym(next_sig(next_sig(curr)), "{"))
+      struct_end = find_close(next_sig(next_sig(curr)), "{", "}");
+    else if(curr == struct_end)
+      struct_end = NULL;
+    if(curr->type != IDENTIFIER || is_sym(prev_sig(curr), ".") ||
+        (struct_end && is_sym(next_sig(curr), ":")))
+      continue;
+    name_entry *rename = find_name_entry(&renames, node_value(curr), NULL);
+    if(rename->name) {
+      const char *survivor = node_value(list.decls[rename->first].name);
+      error = set_token_value(curr, survivor, strlen(survivor));
+    }
+  }
+
+  for(size_t i=0; !error && i<list.count; i++)
+    if(removed[i]) {
+      splice_nodes(head, list.decls[i].first, list.decls[i].last, NULL);
+      *merged = true;
+    }
+
+  for(size_t i=0; removed && i<list.count; i++)
+    free(removed[i]);
+  free(removed);
+  free_name_table(&shapes);
+  free_name_table(&bound);
+  free_name_table(&renames);
+  free_declarations(&list);
+
+  return error;
+}
+
+bool dedup_declarations(token_node **head, const exclude_set *excludes)
+{
+  // Merging structs can make the functions using them identical
+  bool error = false, merged = true;
+  while(!error && merged) {
+    merged = false;
+    error = merge_declarations(head, excludes, &merged);
+  }
+
+  if(!error)
+    compress_whitespaces(head);
+
+  return error;
+}
+
+// Estimated length of the mangled name of a pooled literal
+#define POOLED_NAME_LEN 2
+
+typedef struct literal_context {
+  int depth;      // Parenthesis depth
+  int attr_depth; // Depth of the enclosing attribute arguments, 0 if none
+} literal_context;
+
+// Literals of attributes and template lists stay in place
+bool is_poolable_literal(const token_node *node, literal_context *ctx)
+{
+  if(is_sym(node, "(")) {
+    ctx->depth++;
+    if(!ctx->attr_depth && is_sym(prev_sig(prev_sig(node)), "@"))
+      ctx->attr_depth = ctx->depth;
+  } else if(is_sym(node, ")")) {
+    if(ctx->depth == ctx->attr_depth)
+      ctx->attr_depth = 0;
+    ctx->depth--;
+  }
+
+  if(node->type != LITERAL || ctx->attr_depth)
+    return false;
+  const token_node *next = next_sig(node);
+  return !is_sym(next, ">") && !is_sym(next, ">>");
+}
+
+bool is_worth_pooling(const name_entry *entry)
+{
+  size_t len = strlen(entry->name);
+  // const X=<literal>; plus the uses of X
+  return entry->count * len > entry->count * POOLED_NAME_LEN + len +
+    POOLED_NAME_LEN + 8;
+}
+
+// Returns a name of the form pooled_literal<n> not used by any identifier
+char *create_pool_name(const name_table *names, size_t *suffix)
+{
+  char name[32];
+  do
+    snprintf(name, sizeof(name), "pooled_literal%zu", (*suffix)++);
+  while(has_name(names, name));
+  return strdup(name);
+}
+
+bool append_pool_declaration(token_node **first, token_node **last,
+    const char *name, const char *value)
+{
+  bool error = create_token_node_with_token(last, KEYWORD, "const") ||
+    create_token_node_with_token(last, WHITESPACE, " ") ||
+    create_token_node_with_token(last, IDENTIFIER, name) ||
+    create_token_node_with_token(last, SYMBOL, "=") ||
+    create_token_node_with_token(last, LITERAL, value) ||
+    create_token_node_with_token(last, SYMBOL, ";");
+  if(!*first && *last) {
+    *first = *last;
+    while((*first)->prev)
+      *first = (*first)->prev;
+  }
+  return error;
+}
+
+// Links the declarations behind the enable, requires and diagnostic
+// directives, which have to precede all declarations
+void insert_pool_declarations(token_node **head, token_node *first,
+    token_node *last)
+{
+  token_node *prev = NULL;
+  for(token_node *curr = *head; curr; curr = curr->next) {
+    if(curr->type == WHITESPACE)
+      continue;
+    if(!is_kw(curr, "enable") && !is_kw(curr, "requires") &&
+        !is_kw(curr, "diagnostic"))
+      break;
+    while(curr && !is_sym(curr, ";"))
+      curr = curr->next;
+    if(!curr)
+      break;
+    prev = curr;
+  }
+
+  token_node *next = prev ? prev->next : *head;
+  first->prev = prev;
+  last->next = next;
+  if(prev)
+    prev->next = first;
+  else
+    *head = first;
+  if(next)
+    next->prev = last;
+}
+
+bool pool_literals(token_node **head)
+{
+  name_table literals, names;
+  bool error = init_name_table(&literals, 64);
+  error = init_name_table(&names, 64) || error;
+
+  literal_context ctx = { 0, 0 };
+  for(token_node *curr = *head; !error && curr; curr = curr->next) {
+    if(curr->type == IDENTIFIER)
+      error = add_name(&names, node_value(curr), 0);
+    else if(is_poolable_literal(curr, &ctx)) {
+      name_entry add = { node_value(curr), NULL, 1, 0, 0, 0, NULL };
+      error = merge_name_entry(&literals, &add);
+    }
+  }
+
+  // Literals are replaced by identifier tokens and declared in order of
+  // their first use, the uses count for the mangling rank of the name
+  identifier *pooled = NULL, *last = NULL;
+  token_node *decl_first = NULL, *decl_last = NULL;
+  size_t suffix = 0;
+  ctx = (literal_context){ 0, 0 };
+  for(token_node *curr = *head; !error && curr; curr = curr->next) {
+    if(!is_poolable_literal(curr, &ctx))
+      continue;
+    name_entry *entry = find_name_entry(&literals, node_value(curr), NULL);
+    if(!is_worth_pooling(entry))
+      continue;
+    if(!entry->id) {
+      char *name = create_pool_name(&names, &suffix);
+      entry->id = name ? append_identifier(&pooled, last, name, entry->count) :
+        NULL;
+      free(name);
+      error = !entry->id || append_pool_declaration(&decl_first, &decl_last,
+          entry->id->value, entry->name);
+      if(error)
+        break;
+      last = entry->id;
+      // The literal token of the declaration outlives the replaced ones
+      entry->name = node_value(decl_last->prev);
+    }
+    token_node *repl = NULL;
+    error = create_token_node_with_token(&repl, IDENTIFIER, entry->id->value);
+    if(!error) {
+      splice_nodes(head, curr, curr, repl);
+      curr = repl;
+    }
+  }
+
+  if(!error && decl_first)
+    insert_pool_declarations(head, decl_first, decl_last);
+  else
+    free_token_nodes(decl_first);
+
+  free_identifiers(pooled);
+  free_name_table(&literals);
+  free_name_table(&names);
+
+  return error;
+}
+
+// Lower case letters only, yields 26 one- and 676 two-character names.
+const alphabet default_alphabet = {
+  "abcdefghijklmnopqrstuvwxyz",
+  "abcdefghijklmnopqrstuvwxyz"
+};
+
+// Letters, '_' and (except for the first position) digits, ordered by the
+// frequency of characters in typical shader code. Yields 53 one- and 3339
+// two-character candidates.
+const alphabet extended_alphabet = {
+  "etaoinsrlcdhumpfgvbxyzwkqjETAOINSRLCDHUMPFGVBXYZWKQJ_",
+  "etaoinsrlcdhumpfgvbxyzwkqjETAOINSRLCDHUMPFGVBXYZWKQJ0123456789_"
+};
+
+char *eval_name(size_t cnt, const alphabet *alpha)
+{
+  size_t max_char = strlen(alpha->first);
+  const char *chars = alpha->first;
   size_t i = cnt;
   buffer buf = { NULL, 0, 0 };
   while(i > 0) {
-    if(write_buf_inc(&buf, 'a' + (char)((i - 1) % max_char), 1)) {
+    if(write_buf_inc(&buf, chars[(i - 1) % max_char], 1)) {
       free(buf.ptr);
       return NULL;
     }
-    i = floor((i - 1) / max_char);
+    i = (i - 1) / max_char;
+    chars = alpha->rest;
+    max_char = strlen(alpha->rest);
   }
   return buf_to_str(&buf, true);
 }
 
-bool reassign_identifier_names(identifier *first, const char **exclude_names,
-    size_t exclude_count)
+bool is_reserved_name(const char *name)
+{
+  // '_' alone is a keyword, names starting with '__' are reserved in WGSL
+  return name[0] == '_' && (name[1] == '\0' || name[1] == '_');
+}
+
+char *eval_free_name(size_t *count, const exclude_set *excludes,
+    const alphabet *alpha)
+{
+  while(true) {
+    char *subst = eval_name((*count)++, alpha);
+    if(!subst)
+      return NULL;
+    if(!is_swizzle_name(subst) && !is_reserved_name(subst) &&
+        !is_excluded(subst, excludes) && !is_keyword(subst))
+      return subst;
+    free(subst);
+  }
+}
+
+bool reassign_identifier_names(identifier *first, const exclude_set *excludes,
+    const alphabet *alpha)
 {
   size_t count = 1;
   while(first) {
-    char *subst = eval_name(count++);
+    char *subst = eval_free_name(&count, excludes, alpha);
     if(!subst)
       return true;
-    if(!is_swizzle_name(subst) &&
-        !is_excluded(subst, exclude_names, exclude_count) &&
-        !is_excluded(subst, keywords, keywords_count)) {
-      free(first->value);
-      first->value = subst;
-      first = first->next;
+    free(first->value);
+    first->value = subst;
+    first = first->next;
+  }
+
+  return false;
+}
+
+void free_mangle_cache(mangle_cache *cache)
+{
+  for(size_t i=0; i<cache->size; i++) {
+    free(cache->names[i]);
+    free(cache->substs[i]);
+  }
+  free(cache->names);
+  free(cache->substs);
+  free(cache->counts);
+  *cache = (mangle_cache){ NULL, NULL, NULL, 0 };
+}
+
+// Like reassign_identifier_names(), but continues the name evaluation of the
+// cached run as long as the identifier ranking did not change. The cache is
+// replaced by the new assignment.
+bool reassign_identifier_names_cached(identifier *first,
+    const exclude_set *excludes, const alphabet *alpha, mangle_cache *cache)
+{
+  size_t size = 0;
+  for(identifier *curr = first; curr; curr = curr->next)
+    size++;
+
+  mangle_cache next = { NULL, NULL, NULL, 0 };
+  if(size > 0) {
+    next.names = malloc(size * sizeof(*next.names));
+    next.substs = malloc(size * sizeof(*next.substs));
+    next.counts = malloc(size * sizeof(*next.counts));
+    if(!next.names || !next.substs || !next.counts) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      free_mangle_cache(&next);
+      return true;
+    }
+  }
+
+  bool reuse = true;
+  size_t count = 1;
+  for(identifier *curr = first; curr; curr = curr->next) {
+    size_t i = next.size;
+    reuse = reuse && i < cache->size && strcmp(curr->value, cache->names[i]) == 0;
+    char *subst = NULL;
+    if(reuse) {
+      subst = strdup(cache->substs[i]);
+      count = cache->counts[i];
     } else
+      subst = eval_free_name(&count, excludes, alpha);
+    char *copy = subst ? strdup(subst) : NULL;
+    if(!copy) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
       free(subst);
+      free_mangle_cache(&next);
+      return true;
+    }
+    next.names[i] = curr->value;
+    next.substs[i] = copy;
+    next.counts[i] = count;
+    next.size++;
+    curr->value = subst;
   }
 
+  free_mangle_cache(cache);
+  *cache = next;
+
+  return false;
+}
+
+bool is_member_name_taken(const member_scope *scope, const char *name)
+{
+  for(const member_ref *ref = scope->fixed; ref; ref = ref->next)
+    if(strcmp(member_ref_value(ref), name) == 0)
+      return true;
   return false;
 }
 
-bool update_identifier_nodes(token_node* head)
+// Member names may look like swizzles, e.g. every struct's most used member
+// can be named 'a'.
+bool reassign_member_names(member_scope *scopes, const exclude_set *excludes,
+    const alphabet *alpha)
 {
+  for(; scopes; scopes = scopes->next) {
+    size_t count = 1;
+    identifier *curr = scopes->first;
+    while(curr) {
+      char *subst = eval_name(count++, alpha);
+      if(!subst)
+        return true;
+      if(!is_reserved_name(subst) && !is_member_name_taken(scopes, subst) &&
+          !is_excluded(subst, excludes) && !is_keyword(subst)) {
+        free(curr->value);
+        curr->value = subst;
+        curr = curr->next;
+      } else
+        free(subst);
+    }
+  }
+
+  return false;
+}
+
+bool assign_names(identifier *first, member_scope *scopes,
+    const exclude_set *excludes, const alphabet *alpha)
+{
+  return reassign_identifier_names(first, excludes, alpha) ||
+    reassign_member_names(scopes, excludes, alpha);
+}
+
+char *render_mangled(const token_node *head)
+{
+  buffer buf = { NULL, 0, 0 };
   while(head) {
-    if(head->type == IDENTIFIER) {
-      identifier_token *token = (identifier_token *)head->token;
+    const char *value = ((token *)head->token)->value;
+    if(head->type == IDENTIFIER && ((identifier_token *)head->token)->data)
+      value = ((identifier *)((identifier_token *)head->token)->data)->value;
+    if(write_buf_str(&buf, value)) {
+      free(buf.ptr);
+      return NULL;
+    }
+    head = head->next;
+  }
+  return buf_to_str(&buf, true);
+}
+
+bool estimate_mangled(const token_node *head, size_t *raw, size_t *compressed)
+{
+  char *text = render_mangled(head);
+  if(!text)
+    return true;
+  *raw = strlen(text);
+  *compressed = estimate_compressed_size(text, *raw);
+  free(text);
+  return false;
+}
+
+// Orders the characters of the given alphabet by their frequency in the text
+// that is not going to be mangled, so that mangled names share the symbols
+// the compressor has already seen most.
+void rank_alphabet(char *chars, const size_t *char_freq)
+{
+  size_t len = strlen(chars);
+  for(size_t i=1; i<len; i++) {
+    char c = chars[i];
+    size_t j = i;
+    while(j > 0 && char_freq[(unsigned char)chars[j - 1]] < char_freq[(unsigned char)c]) {
+      chars[j] = chars[j - 1];
+      j--;
+    }
+    chars[j] = c;
+  }
+}
+
+bool reassign_identifier_names_compressed(identifier *first,
+    member_scope *scopes, const token_node *head, const exclude_set *excludes,
+    const alphabet *alpha)
+{
+  size_t char_freq[256] = { 0 };
+  for(const token_node *curr = head; curr; curr = curr->next)
+    if(curr->type != IDENTIFIER || !((identifier_token *)curr->token)->data)
+      for(const char *c = ((token *)curr->token)->value; *c; c++)
+        char_freq[(unsigned char)*c]++;
+
+  char *first_chars = strdup(alpha->first);
+  char *rest_chars = strdup(alpha->rest);
+  if(!first_chars || !rest_chars) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(first_chars);
+    free(rest_chars);
+    return true;
+  }
+  rank_alphabet(first_chars, char_freq);
+  rank_alphabet(rest_chars, char_freq);
+  alphabet ranked = { first_chars, rest_chars };
+
+  size_t raw = 0, default_compressed = 0, compressed = 0;
+  bool error = assign_names(first, scopes, excludes, alpha);
+  if(!error)
+    error = estimate_mangled(head, &raw, &default_compressed);
+  if(!error)
+    error = assign_names(first, scopes, excludes, &ranked);
+  if(!error)
+    error = estimate_mangled(head, &raw, &compressed);
+  if(!error && compressed > default_compressed) {
+    error = assign_names(first, scopes, excludes, alpha);
+    if(!error)
+      error = estimate_mangled(head, &raw, &compressed);
+  }
+
+  free(first_chars);
+  free(rest_chars);
+
+  // Swap names of equal length between identifiers of similar rank. This
+  // keeps the raw size but may create longer repeated sequences.
+  const size_t swap_window = 4;
+  size_t max_evals = raw > 0 ? (64 << 20) / raw : 0;
+  max_evals = max_evals < 4 ? 4 : (max_evals > 256 ? 256 : max_evals);
+  for(identifier *a = first; !error && a && max_evals > 0; a = a->next) {
+    identifier *b = a->next;
+    for(size_t i=0; !error && b && i<swap_window && max_evals > 0; i++, b = b->next) {
+      if(strlen(a->value) != strlen(b->value))
+        continue;
+      char *tmp = a->value;
+      a->value = b->value;
+      b->value = tmp;
+      size_t swapped_raw, swapped_compressed;
+      error = reassign_member_names(scopes, excludes, alpha);
+      if(!error)
+        error = estimate_mangled(head, &swapped_raw, &swapped_compressed);
+      max_evals--;
+      if(!error && swapped_compressed < compressed)
+        compressed = swapped_compressed;
+      else if(!error) {
+        b->value = a->value;
+        a->value = tmp;
+        error = reassign_member_names(scopes, excludes, alpha);
+      }
+    }
+  }
+
+  if(!error)
+    fprintf(stderr, "Raw size: %zu bytes, estimated compressed size: %zu bytes "
+        "(%zu bytes with frequency ranked names)\n", raw, compressed,
+        default_compressed);
+
+  return error;
+}
+
+int update_identifier_range(void *arg)
+{
+  uint64_t begin = trace_begin();
+  count_task *task = arg;
+  for(token_node *curr = task->start; !task->error && curr != task->end;
+      curr = curr->next) {
+    if(curr->type == IDENTIFIER) {
+      identifier_token *token = (identifier_token *)curr->token;
       if(token->data) {
         identifier *id = (identifier *)token->data;
         if(id->value) {
-          char *subst = strdup(id->value);
-          if(!subst) {
-            fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
-            return true;
-          }
-          free(token->value);
-          token->value = subst;
+          share_token_value(curr, id->value);
           token->data = NULL;
         }
       }
     }
-    head = head->next;
+  }
+  trace_end("update_identifier_range", begin);
+
+  return 0;
+}
+
+bool update_identifier_nodes(token_node* head, size_t threads)
+{
+  count_task *tasks = calloc(threads > 1 ? threads : 1, sizeof(*tasks));
+  if(!tasks) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
   }
 
+  size_t count = 1;
+  tasks[0].start = head;
+  if(threads > 1 && head)
+    count = split_tokens(head, tasks, threads);
+  run_tasks(update_identifier_range, tasks, sizeof(*tasks), count);
+
+  bool error = false;
+  for(size_t i=0; i<count; i++)
+    error = error || tasks[i].error;
+  free(tasks);
+
+  return error;
+}
+
+size_t count_all_identifiers(identifier *first, member_scope *scopes)
+{
+  size_t count = 0;
+  for(identifier *curr = first; curr; curr = curr->next)
+    count++;
+  for(member_scope *scope = scopes; scope; scope = scope->next)
+    for(identifier *curr = scope->first; curr; curr = curr->next)
+      count++;
+  return count;
+}
+
+bool reserve_mangled_names(mangled_names *names, size_t count)
+{
+  char **reserved = realloc(names->names,
+      (names->count + count) * sizeof(*reserved));
+  if(!reserved && count > 0) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  names->names = reserved;
   return false;
 }
 
+// Moves the names of the identifiers to the reserved mangled names, identifier
+// tokens refer to them after update_identifier_nodes()
+void keep_mangled_names(identifier *first, member_scope *scopes,
+    mangled_names *names)
+{
+  for(identifier *curr = first; curr; curr = curr->next) {
+    names->names[names->count++] = curr->value;
+    curr->value = NULL;
+  }
+  for(member_scope *scope = scopes; scope; scope = scope->next) {
+    for(identifier *curr = scope->first; curr; curr = curr->next) {
+      names->names[names->count++] = curr->value;
+      curr->value = NULL;
+    }
+  }
+}
+
+void free_mangled_names(mangled_names *names)
+{
+  for(size_t i=0; i<names->count; i++)
+    free(names->names[i]);
+  free(names->names);
+  *names = (mangled_names){ NULL, 0 };
+}
+
 void print_identifiers(identifier *first)
 {
   while(first) {
@@ -337,7 +1522,7 @@ void print_unique_identifiers(identifier *first)
 void free_identifier(identifier *identifier)
 {
   free(identifier->value);
-  free(identifier);
+  mem_free(MEM_IDENTIFIERS, identifier, sizeof(*identifier));
 }
 
 void free_identifiers(identifier *first)
@@ -349,24 +1534,58 @@ void free_identifiers(identifier *first)
   }
 }
 
-bool mangle(token_node **head, const char **exclude_names, size_t exclude_count, bool print_unused)
+bool mangle(token_node **head, const mangle_options *options,
+    mangled_names *names)
 {
   identifier *first = NULL;
-  bool error =
-    create_identifier_list(&first, *head, exclude_names, exclude_count);
+  member_scope *scopes = NULL;
+  struct_decl *structs = NULL;
+  uint64_t begin = trace_begin();
+  bool error = classify_identifiers(*head, &structs);
+  trace_end("classify_identifiers", begin);
+  begin = trace_begin();
+  if(!error)
+    error = options->threads > 1 ?
+      create_identifier_list_parallel(&first, &scopes, *head,
+          options->excludes, options->threads) :
+      create_identifier_list(&first, &scopes, *head, options->excludes);
+  trace_end("create_identifier_list", begin);
 
-  if(!error && print_unused)
+  if(!error && options->print_unused) {
     print_unique_identifiers(first);
+    for(member_scope *scope = scopes; scope; scope = scope->next)
+      print_unique_identifiers(scope->first);
+  }
  
-  if(!print_unused) {
-    if(!error)
-      error = reassign_identifier_names(first, exclude_names, exclude_count);
+  if(!options->print_unused) {
+    const alphabet *alpha = options->extended_alphabet ?
+      &extended_alphabet : &default_alphabet;
+    begin = trace_begin();
+    if(!error && options->compress_aware)
+      error = reassign_identifier_names_compressed(first, scopes, *head,
+          options->excludes, alpha);
+    else if(!error && options->cache)
+      error = reassign_identifier_names_cached(first, options->excludes, alpha,
+          options->cache) ||
+        reassign_member_names(scopes, options->excludes, alpha);
+    else if(!error)
+      error = assign_names(first, scopes, options->excludes, alpha);
+    trace_end("assign_names", begin);
 
+    // Tokens share the names, which therefore outlive the identifiers
+    begin = trace_begin();
     if(!error)
-      error = update_identifier_nodes(*head);
+      error = reserve_mangled_names(names, count_all_identifiers(first, scopes));
+    if(!error) {
+      error = update_identifier_nodes(*head, options->threads);
+      keep_mangled_names(first, scopes, names);
+    }
+    trace_end("update_identifier_nodes", begin);
   }
   
   free_identifiers(first);
+  free_member_scopes(scopes);
+  free_struct_decls(structs);
 
   return error;
 }
@@ -3,11 +3,48 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "exclude.h"
 
 typedef struct token_node token_node;
 
+// Global name assignment of a previous mangle() run in identifier rank order.
+// Passed via mangle_options, names are reused for the longest prefix of the
+// ranking that did not change.
+typedef struct mangle_cache {
+  char **names;
+  char **substs;
+  size_t *counts;
+  size_t size;
+} mangle_cache;
+
+typedef struct mangle_options {
+  const exclude_set *excludes; // NULL if there are none
+  bool print_unused;
+  bool extended_alphabet;
+  bool compress_aware;
+  mangle_cache *cache; // Optional, ignored if compress_aware is set
+  size_t threads;      // Counts and renames identifiers in parallel if > 1
+} mangle_options;
+
+// Names assigned by mangle(). Identifier tokens refer to the name of their
+// identifier instead of holding a copy, so the names are released after the
+// tokens. Zero initialize before use.
+typedef struct mangled_names {
+  char **names;
+  size_t count;
+} mangled_names;
+
 bool minify(token_node **head);
-bool mangle(token_node **head, const char **exclude_names,
-    size_t exclude_count, bool print_unused);
+void compress_whitespaces(token_node **head);
+// Merges functions and structs that are identical apart from their local
+// names and renames all references to the first of them
+bool dedup_declarations(token_node **head, const exclude_set *excludes);
+// Replaces long literals that are repeated often enough by the name of a
+// module scope const declared for them
+bool pool_literals(token_node **head);
+bool mangle(token_node **head, const mangle_options *options,
+    mangled_names *names);
+void free_mangled_names(mangled_names *names);
+void free_mangle_cache(mangle_cache *cache);
 
 #endif
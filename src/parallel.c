@@ -0,0 +1,24 @@
+#include "parallel.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <threads.h>
+
+void run_tasks(int (*func)(void *), void *tasks, size_t task_size,
+    size_t count)
+{
+  thrd_t *ids = count > 1 ? malloc(count * sizeof(*ids)) : NULL;
+  bool *started = count > 1 ? calloc(count, sizeof(*started)) : NULL;
+  for(size_t i=1; ids && started && i<count; i++)
+    started[i] = thrd_create(&ids[i], func,
+        (char *)tasks + i * task_size) == thrd_success;
+
+  for(size_t i=0; i<count; i++) {
+    if(started && started[i])
+      thrd_join(ids[i], NULL);
+    else
+      func((char *)tasks + i * task_size);
+  }
+
+  free(ids);
+  free(started);
+}
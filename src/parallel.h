@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+// Runs func for each of the count tasks stored consecutively in tasks, one
+// thread per task. The first task and tasks whose thread cannot be created
+// run on the calling thread. Returns after all tasks are done.
+void run_tasks(int (*func)(void *), void *tasks, size_t task_size,
+    size_t count);
+
+#endif
@@ -0,0 +1,607 @@
+#include "preprocess.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "syntax.h"
+#include "tokenize.h"
+
+// Nesting limit for macros referenced in #if expressions
+#define MAX_EXPR_DEPTH 32
+
+typedef struct macro {
+  char *name;
+  bool has_value;
+  token_node *value; // Tokens of the value without surrounding whitespace
+  struct macro *next;
+} macro;
+
+typedef struct condition {
+  bool parent_active;
+  bool taken; // Some branch of the #if was active already
+  bool active;
+  bool has_else;
+  struct condition *next;
+} condition;
+
+typedef struct expr_state {
+  const token_node *curr;
+  const macro *macros;
+  size_t depth;
+  bool error;
+} expr_state;
+
+bool is_name_str(const char *name, size_t len)
+{
+  return len > 0 && scan_name(name, len, 0) == len;
+}
+
+bool add_define(define **first, const char *str)
+{
+  const char *eq = strchr(str, '=');
+  size_t name_len = eq ? (size_t)(eq - str) : strlen(str);
+  if(!is_name_str(str, name_len)) {
+    fprintf(stderr, "Illegal define '%s'\n", str);
+    return true;
+  }
+
+  define *d = malloc(sizeof(*d));
+  if(!d) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  d->name = strndup(str, name_len);
+  d->value = eq ? strdup(eq + 1) : NULL;
+  d->next = NULL;
+  if(!d->name || (eq && !d->value)) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(d->name);
+    free(d->value);
+    free(d);
+    return true;
+  }
+
+  while(*first)
+    first = &(*first)->next;
+  *first = d;
+
+  return false;
+}
+
+void free_defines(define *first)
+{
+  while(first) {
+    define *next = first->next;
+    free(first->name);
+    free(first->value);
+    free(first);
+    first = next;
+  }
+}
+
+bool read_variants(FILE *file, variant **first)
+{
+  char *src;
+  size_t len;
+  if(read_file(file, &src, &len))
+    return true;
+
+  bool error = false;
+  variant **last = first;
+  size_t pos = 0;
+  while(!error && pos < len) {
+    size_t line_len = 0;
+    while(pos + line_len < len && src[pos + line_len] != '\n')
+      line_len++;
+
+    variant *v = malloc(sizeof(*v));
+    if(!v) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      error = true;
+      break;
+    }
+    v->defines = NULL;
+    v->next = NULL;
+    *last = v;
+    last = &v->next;
+
+    size_t i = pos, end = pos + line_len;
+    while(!error && i < end) {
+      while(i < end && (src[i] == ' ' || src[i] == '\t' || src[i] == '\r'))
+        i++;
+      size_t word_len = 0;
+      while(i + word_len < end && src[i + word_len] != ' ' &&
+          src[i + word_len] != '\t' && src[i + word_len] != '\r')
+        word_len++;
+      if(word_len > 0) {
+        char *word = strndup(src + i, word_len);
+        if(!word) {
+          fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+          error = true;
+        } else
+          error = add_define(&v->defines, word);
+        free(word);
+      }
+      i += word_len;
+    }
+
+    pos = end + 1;
+  }
+
+  free_source(src, len);
+  if(error) {
+    free_variants(*first);
+    *first = NULL;
+  }
+
+  return error;
+}
+
+void free_variants(variant *first)
+{
+  while(first) {
+    variant *next = first->next;
+    free_defines(first->defines);
+    free(first);
+    first = next;
+  }
+}
+
+const macro *find_macro(const macro *first, const char *name)
+{
+  while(first && strcmp(first->name, name) != 0)
+    first = first->next;
+  return first;
+}
+
+void free_macros(macro *first)
+{
+  while(first) {
+    macro *next = first->next;
+    free(first->name);
+    free_token_nodes(first->value);
+    free(first);
+    first = next;
+  }
+}
+
+// Tokenizes the value, dropping comments and surrounding whitespace
+bool tokenize_value(const char *value, token_node **head)
+{
+  if(tokenize_str(value, strlen(value), head))
+    return true;
+
+  token_node *curr = *head;
+  while(curr) {
+    token_node *next = curr->next;
+    if(curr->type == COMMENT || curr->type == DIRECTIVE)
+      splice_nodes(head, curr, curr, NULL);
+    curr = next;
+  }
+
+  while(*head && (*head)->type == WHITESPACE)
+    splice_nodes(head, *head, *head, NULL);
+  token_node *last = *head;
+  while(last && last->next)
+    last = last->next;
+  while(last && last->type == WHITESPACE) {
+    token_node *prev = last->prev;
+    splice_nodes(head, last, last, NULL);
+    last = prev;
+  }
+
+  return false;
+}
+
+// Defines or redefines a macro, the most recent definition is found first
+bool add_macro(macro **first, const char *name, const char *value)
+{
+  macro *m = malloc(sizeof(*m));
+  if(!m) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  m->name = strdup(name);
+  m->has_value = value != NULL;
+  m->value = NULL;
+  m->next = *first;
+  if(!m->name) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(m);
+    return true;
+  }
+  if(value && tokenize_value(value, &m->value)) {
+    free(m->name);
+    free(m);
+    return true;
+  }
+
+  *first = m;
+
+  return false;
+}
+
+const token_node *first_sig(const token_node *node)
+{
+  if(node && (node->type == WHITESPACE || node->type == COMMENT))
+    return next_sig(node);
+  return node;
+}
+
+long eval_expr(expr_state *s);
+
+void expr_error(expr_state *s, const char *msg)
+{
+  if(!s->error)
+    fprintf(stderr, "Illegal #if expression: %s%s%s\n", msg,
+        s->curr ? " at " : "", s->curr ? node_value(s->curr) : "");
+  s->error = true;
+}
+
+void expr_advance(expr_state *s)
+{
+  s->curr = next_sig(s->curr);
+}
+
+bool expr_sym(expr_state *s, const char *symbol)
+{
+  if(is_sym(s->curr, symbol)) {
+    expr_advance(s);
+    return true;
+  }
+  return false;
+}
+
+long eval_macro(expr_state *s, const macro *m)
+{
+  if(!m)
+    return 0;
+  if(!m->has_value)
+    return 1;
+  if(s->depth >= MAX_EXPR_DEPTH) {
+    expr_error(s, "macro nesting too deep");
+    return 0;
+  }
+
+  expr_state sub = { first_sig(m->value), s->macros, s->depth + 1, false };
+  long v = eval_expr(&sub);
+  if(!sub.error && sub.curr)
+    expr_error(&sub, "unexpected token");
+  s->error = s->error || sub.error;
+
+  return v;
+}
+
+long eval_primary(expr_state *s)
+{
+  const token_node *node = s->curr;
+  if(!node) {
+    expr_error(s, "unexpected end");
+    return 0;
+  }
+
+  if(expr_sym(s, "(")) {
+    long v = eval_expr(s);
+    if(!expr_sym(s, ")"))
+      expr_error(s, "missing ')'");
+    return v;
+  }
+
+  if(node->type == IDENTIFIER && strcmp(node_value(node), "defined") == 0) {
+    expr_advance(s);
+    bool paren = expr_sym(s, "(");
+    if(!s->curr || (s->curr->type != IDENTIFIER && s->curr->type != KEYWORD)) {
+      expr_error(s, "missing name after defined");
+      return 0;
+    }
+    long v = find_macro(s->macros, node_value(s->curr)) != NULL;
+    expr_advance(s);
+    if(paren && !expr_sym(s, ")"))
+      expr_error(s, "missing ')'");
+    return v;
+  }
+
+  if(node->type == LITERAL) {
+    char *end;
+    long v = strtol(node_value(node), &end, 0);
+    if(*end != '\0' && strcmp(end, "u") != 0 && strcmp(end, "i") != 0)
+      expr_error(s, "not an integer");
+    expr_advance(s);
+    return v;
+  }
+
+  if(is_kw(node, "true") || is_kw(node, "false")) {
+    expr_advance(s);
+    return is_kw(node, "true");
+  }
+
+  if(node->type == IDENTIFIER || node->type == KEYWORD) {
+    expr_advance(s);
+    return eval_macro(s, find_macro(s->macros, node_value(node)));
+  }
+
+  expr_error(s, "unexpected token");
+  return 0;
+}
+
+long eval_unary(expr_state *s)
+{
+  if(expr_sym(s, "!"))
+    return !eval_unary(s);
+  if(expr_sym(s, "-"))
+    return -eval_unary(s);
+  return eval_primary(s);
+}
+
+long eval_mul(expr_state *s)
+{
+  long v = eval_unary(s);
+  while(!s->error) {
+    if(expr_sym(s, "*"))
+      v *= eval_unary(s);
+    else if(is_sym(s->curr, "/") || is_sym(s->curr, "%")) {
+      bool div = is_sym(s->curr, "/");
+      expr_advance(s);
+      long r = eval_unary(s);
+      if(r == 0) {
+        expr_error(s, "division by zero");
+        return 0;
+      }
+      v = div ? v / r : v % r;
+    } else
+      break;
+  }
+  return v;
+}
+
+long eval_add(expr_state *s)
+{
+  long v = eval_mul(s);
+  while(!s->error) {
+    if(expr_sym(s, "+"))
+      v += eval_mul(s);
+    else if(expr_sym(s, "-"))
+      v -= eval_mul(s);
+    else
+      break;
+  }
+  return v;
+}
+
+long eval_rel(expr_state *s)
+{
+  long v = eval_add(s);
+  while(!s->error) {
+    if(expr_sym(s, "<="))
+      v = v <= eval_add(s);
+    else if(expr_sym(s, ">="))
+      v = v >= eval_add(s);
+    else if(expr_sym(s, "<"))
+      v = v < eval_add(s);
+    else if(expr_sym(s, ">"))
+      v = v > eval_add(s);
+    else
+      break;
+  }
+  return v;
+}
+
+long eval_eq(expr_state *s)
+{
+  long v = eval_rel(s);
+  while(!s->error) {
+    if(expr_sym(s, "=="))
+      v = v == eval_rel(s);
+    else if(expr_sym(s, "!="))
+      v = v != eval_rel(s);
+    else
+      break;
+  }
+  return v;
+}
+
+long eval_and(expr_state *s)
+{
+  long v = eval_eq(s);
+  while(!s->error && expr_sym(s, "&&")) {
+    long r = eval_eq(s);
+    v = v && r;
+  }
+  return v;
+}
+
+long eval_expr(expr_state *s)
+{
+  long v = eval_and(s);
+  while(!s->error && expr_sym(s, "||")) {
+    long r = eval_and(s);
+    v = v || r;
+  }
+  return v;
+}
+
+bool eval_condition(const char *text, const macro *macros, bool *result)
+{
+  token_node *head = NULL;
+  if(tokenize_str(text, strlen(text), &head))
+    return true;
+
+  expr_state s = { first_sig(head), macros, 0, false };
+  if(!s.curr)
+    expr_error(&s, "missing expression");
+  long v = eval_expr(&s);
+  if(!s.error && s.curr)
+    expr_error(&s, "unexpected token");
+  *result = v != 0;
+  free_token_nodes(head);
+
+  return s.error;
+}
+
+bool push_condition(condition **conds, bool result)
+{
+  condition *c = malloc(sizeof(*c));
+  if(!c) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  c->parent_active = !*conds || (*conds)->active;
+  c->active = c->parent_active && result;
+  c->taken = result;
+  c->has_else = false;
+  c->next = *conds;
+  *conds = c;
+
+  return false;
+}
+
+// Splits "#name rest" into the directive name and the text after it
+bool split_directive(const char *text, char **name, const char **rest)
+{
+  text++;
+  while(*text == ' ' || *text == '\t')
+    text++;
+  size_t len = scan_name(text, strlen(text), 0);
+  *name = strndup(text, len);
+  if(!*name) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  text += len;
+  while(*text == ' ' || *text == '\t')
+    text++;
+  *rest = text;
+
+  return false;
+}
+
+// Name operand of #ifdef, #ifndef and #define
+char *directive_name(const char *name, const char *rest, const char **value)
+{
+  size_t len = scan_name(rest, strlen(rest), 0);
+  if(len == 0) {
+    fprintf(stderr, "Missing name after #%s\n", name);
+    return NULL;
+  }
+  char *res = strndup(rest, len);
+  if(!res)
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+  *value = rest + len;
+
+  return res;
+}
+
+bool eval_directive(const char *text, condition **conds, macro **macros)
+{
+  char *name;
+  const char *rest;
+  if(split_directive(text, &name, &rest))
+    return true;
+
+  bool active = !*conds || (*conds)->active;
+  bool error = false;
+  bool result = false;
+  const char *value = NULL;
+  char *operand = NULL;
+  condition *c = *conds;
+
+  if(strcmp(name, "if") == 0) {
+    if(active)
+      error = eval_condition(rest, *macros, &result);
+    error = error || push_condition(conds, result);
+  } else if(strcmp(name, "ifdef") == 0 || strcmp(name, "ifndef") == 0) {
+    operand = directive_name(name, rest, &value);
+    if(operand)
+      error = push_condition(conds,
+          (find_macro(*macros, operand) != NULL) == (name[2] == 'd'));
+    else
+      error = true;
+  } else if(strcmp(name, "elif") == 0) {
+    if(!c || c->has_else) {
+      fprintf(stderr, "Unexpected #elif\n");
+      error = true;
+    } else {
+      if(c->parent_active && !c->taken)
+        error = eval_condition(rest, *macros, &result);
+      c->active = c->parent_active && !c->taken && result;
+      c->taken = c->taken || result;
+    }
+  } else if(strcmp(name, "else") == 0) {
+    if(!c || c->has_else) {
+      fprintf(stderr, "Unexpected #else\n");
+      error = true;
+    } else {
+      c->active = c->parent_active && !c->taken;
+      c->taken = true;
+      c->has_else = true;
+    }
+  } else if(strcmp(name, "endif") == 0) {
+    if(!c) {
+      fprintf(stderr, "Unexpected #endif\n");
+      error = true;
+    } else {
+      *conds = c->next;
+      free(c);
+    }
+  } else if(strcmp(name, "define") == 0) {
+    if(active) {
+      operand = directive_name(name, rest, &value);
+      if(operand) {
+        while(*value == ' ' || *value == '\t')
+          value++;
+        error = add_macro(macros, operand, *value ? value : NULL);
+      } else
+        error = true;
+    }
+  } else {
+    fprintf(stderr, "Unknown directive #%s\n", name);
+    error = true;
+  }
+
+  free(operand);
+  free(name);
+
+  return error;
+}
+
+bool preprocess(token_node **head, const define *defines)
+{
+  macro *macros = NULL;
+  condition *conds = NULL;
+  bool error = false;
+  for(const define *d = defines; !error && d; d = d->next)
+    error = add_macro(&macros, d->name, d->value);
+
+  token_node *curr = *head;
+  while(!error && curr) {
+    token_node *next = curr->next;
+    const macro *m = NULL;
+    if(curr->type == DIRECTIVE) {
+      error = eval_directive(node_value(curr), &conds, &macros);
+      splice_nodes(head, curr, curr, NULL);
+    } else if(conds && !conds->active)
+      splice_nodes(head, curr, curr, NULL);
+    else if(curr->type == IDENTIFIER &&
+        (m = find_macro(macros, node_value(curr))) && m->has_value) {
+      token_node *value = NULL;
+      error = copy_token_nodes(m->value, &value);
+      if(!error)
+        splice_nodes(head, curr, curr, value);
+    }
+    curr = next;
+  }
+
+  if(!error && conds) {
+    fprintf(stderr, "Missing #endif\n");
+    error = true;
+  }
+
+  while(conds) {
+    condition *next = conds->next;
+    free(conds);
+    conds = next;
+  }
+  free_macros(macros);
+
+  return error;
+}
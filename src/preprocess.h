@@ -0,0 +1,35 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct token_node token_node;
+
+typedef struct define {
+  char *name;
+  char *value; // NULL if defined without value
+  struct define *next;
+} define;
+
+// Set of defines for one output variant
+typedef struct variant {
+  define *defines;
+  struct variant *next;
+} variant;
+
+// Parses NAME or NAME=value and appends it to the list
+bool add_define(define **first, const char *str);
+void free_defines(define *first);
+
+// Reads one variant per line, each a whitespace separated list of NAME or
+// NAME=value. An empty line is a variant without defines.
+bool read_variants(FILE *file, variant **first);
+void free_variants(variant *first);
+
+// Evaluates #if/#ifdef/#ifndef/#elif/#else/#endif and #define directives.
+// Directives and tokens of inactive branches are removed and identifiers
+// defined with a value are replaced by the tokens of the value.
+bool preprocess(token_node **head, const define *defines);
+
+#endif
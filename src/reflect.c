@@ -0,0 +1,241 @@
+#include "reflect.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+#include "charclass.h"
+#include "syntax.h"
+#include "tokenize.h"
+#include "unicode.h"
+
+typedef struct attributes {
+  long group;
+  long binding;
+  long id;
+  const char *stage;
+} attributes;
+
+// Value of an attribute like @binding(2), -1 if it is not an integer literal
+long attribute_value(const token_node *open)
+{
+  const token_node *value = next_sig(open);
+  if(!value || value->type != LITERAL || !is_sym(next_sig(value), ")"))
+    return -1;
+  char *end;
+  long v = strtol(node_value(value), &end, 0);
+  return (*end == '\0' || ((*end == 'u' || *end == 'i') && end[1] == '\0')) ?
+    v : -1;
+}
+
+// Reads the attributes starting at node and returns the token following them
+const token_node *read_attributes(const token_node *node, attributes *attrs)
+{
+  *attrs = (attributes){ -1, -1, -1, NULL };
+  while(is_sym(node, "@")) {
+    const token_node *name = next_sig(node);
+    const token_node *open = next_sig(name);
+    if(is_kw(name, "group") && is_sym(open, "("))
+      attrs->group = attribute_value(open);
+    else if(is_kw(name, "binding") && is_sym(open, "("))
+      attrs->binding = attribute_value(open);
+    else if(is_kw(name, "id") && is_sym(open, "("))
+      attrs->id = attribute_value(open);
+    else if(is_kw(name, "vertex") || is_kw(name, "fragment") ||
+        is_kw(name, "compute"))
+      attrs->stage = node_value(name);
+    node = is_sym(open, "(") ? next_sig(find_close(open, "(", ")")) : open;
+  }
+  return node;
+}
+
+bool add_reflection(reflection ***last, reflection_kind kind,
+    const token_node *name, const attributes *attrs, const char *space)
+{
+  reflection *r = malloc(sizeof(*r));
+  if(!r) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+  *r = (reflection){ kind, strdup(node_value(name)), name, space,
+    attrs->stage, attrs->group, attrs->binding, attrs->id, NULL };
+  if(!r->name) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(r);
+    return true;
+  }
+  **last = r;
+  *last = &r->next;
+  return false;
+}
+
+bool collect_reflection(const token_node *head, reflection **first)
+{
+  reflection **last = first;
+  bool error = false;
+  int depth = 0;
+  for(const token_node *curr = head; !error && curr; curr = next_sig(curr)) {
+    if(is_sym(curr, "{"))
+      depth++;
+    else if(is_sym(curr, "}"))
+      depth--;
+    if(depth > 0)
+      continue;
+
+    attributes attrs = { -1, -1, -1, NULL };
+    const token_node *decl = is_sym(curr, "@") ?
+      read_attributes(curr, &attrs) : curr;
+    const token_node *name = next_sig(decl);
+    if(is_kw(decl, "var") && attrs.group >= 0 && attrs.binding >= 0) {
+      const token_node *space = NULL;
+      if(is_sym(name, "<")) {
+        space = next_sig(name);
+        name = next_sig(find_close(name, "<", ">"));
+      }
+      if(name && name->type == IDENTIFIER)
+        error = add_reflection(&last, RESOURCE, name, &attrs,
+            space ? node_value(space) : "handle");
+    } else if(is_kw(decl, "fn") && attrs.stage) {
+      if(name && name->type == IDENTIFIER)
+        error = add_reflection(&last, ENTRY_POINT, name, &attrs, NULL);
+    } else if(is_kw(decl, "override")) {
+      if(name && name->type == IDENTIFIER)
+        error = add_reflection(&last, OVERRIDE, name, &attrs, NULL);
+    }
+
+    // Continue behind the declaring keyword
+    if(decl && decl->type == KEYWORD)
+      curr = decl;
+  }
+
+  if(error) {
+    free_reflection(*first);
+    *first = NULL;
+  }
+
+  return error;
+}
+
+void write_json_entry(FILE *file, const reflection *r, bool *first_entry)
+{
+  fprintf(file, "%s\n    { \"name\": \"%s\", \"mangled\": \"%s\"",
+      *first_entry ? "" : ",", r->name, node_value(r->node));
+  if(r->kind == RESOURCE)
+    fprintf(file, ", \"group\": %ld, \"binding\": %ld, \"space\": \"%s\"",
+        r->group, r->binding, r->space);
+  else if(r->kind == ENTRY_POINT)
+    fprintf(file, ", \"stage\": \"%s\"", r->stage);
+  else if(r->id >= 0)
+    fprintf(file, ", \"id\": %ld", r->id);
+  fprintf(file, " }");
+  *first_entry = false;
+}
+
+void write_json(FILE *file, const reflection *first)
+{
+  const char *sections[] = { "resources", "entry_points", "overrides" };
+  fprintf(file, "{");
+  for(size_t kind=RESOURCE; kind<=OVERRIDE; kind++) {
+    bool first_entry = true;
+    fprintf(file, "%s\n  \"%s\": [", kind > RESOURCE ? "," : "",
+        sections[kind]);
+    for(const reflection *r = first; r; r = r->next)
+      if(r->kind == kind)
+        write_json_entry(file, r, &first_entry);
+    fprintf(file, "%s]", first_entry ? "" : "\n  ");
+  }
+  fprintf(file, "\n}\n");
+}
+
+// Writes WGSL_<name>_<suffix> with the characters of the name other than
+// ASCII letters, digits and '_' escaped as _uXXXX or _UXXXXXXXX
+void write_macro_name(FILE *file, const char *name, const char *suffix)
+{
+  fprintf(file, "#define WGSL_");
+  size_t len = strlen(name);
+  for(size_t i=0; i<len;) {
+    uint32_t cp;
+    size_t n = decode_utf8(name, len, i, &cp);
+    if(n == 0) {
+      cp = (unsigned char)name[i];
+      n = 1;
+    }
+    if(cp < 0x80 && (has_class(cp, CC_ALPHA | CC_DIGIT) || cp == '_'))
+      fputc(cp, file);
+    else
+      fprintf(file, cp > 0xffff ? "_U%08X" : "_u%04X", (unsigned)cp);
+    i += n;
+  }
+  fprintf(file, "_%s ", suffix);
+}
+
+// Writes the value as C string literal with non-ASCII bytes as octal escapes
+void write_c_string(FILE *file, const char *value)
+{
+  fputc('"', file);
+  for(const unsigned char *c = (const unsigned char *)value; *c; c++) {
+    if(*c >= 0x80)
+      fprintf(file, "\\%03o", *c);
+    else if(*c == '"' || *c == '\\')
+      fprintf(file, "\\%c", *c);
+    else
+      fputc(*c, file);
+  }
+  fputc('"', file);
+}
+
+void write_header(FILE *file, const reflection *first)
+{
+  fprintf(file, "// Generated by wgslminify\n#ifndef WGSL_REFLECTION_H\n"
+      "#define WGSL_REFLECTION_H\n\n");
+  for(const reflection *r = first; r; r = r->next) {
+    write_macro_name(file, r->name, "NAME");
+    write_c_string(file, node_value(r->node));
+    fputc('\n', file);
+    if(r->kind == RESOURCE) {
+      write_macro_name(file, r->name, "GROUP");
+      fprintf(file, "%ld\n", r->group);
+      write_macro_name(file, r->name, "BINDING");
+      fprintf(file, "%ld\n", r->binding);
+    } else if(r->kind == OVERRIDE && r->id >= 0) {
+      write_macro_name(file, r->name, "ID");
+      fprintf(file, "%ld\n", r->id);
+    }
+  }
+  fprintf(file, "\n#endif\n");
+}
+
+bool write_reflection(const char *filename, const reflection *first)
+{
+  FILE *file = fopen(filename, "w");
+  if(!file) {
+    fprintf(stderr, "Failed to open '%s': %s\n", filename, strerror(errno));
+    return true;
+  }
+
+  size_t len = strlen(filename);
+  if(len > 2 && strcmp(filename + len - 2, ".h") == 0)
+    write_header(file, first);
+  else
+    write_json(file, first);
+
+  bool error = ferror(file) != 0;
+  if(error)
+    fprintf(stderr, "Failed to write '%s': %s\n", filename, strerror(errno));
+  if(fclose(file) != 0) {
+    fprintf(stderr, "Failed to close file: %s\n", strerror(errno));
+    error = true;
+  }
+
+  return error;
+}
+
+void free_reflection(reflection *first)
+{
+  while(first) {
+    reflection *next = first->next;
+    free(first->name);
+    free(first);
+    first = next;
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef REFLECT_H
+#define REFLECT_H
+
+#include <stdbool.h>
+
+typedef struct token_node token_node;
+
+typedef enum reflection_kind {
+  RESOURCE,    // var with @group and @binding
+  ENTRY_POINT, // fn with @vertex, @fragment or @compute
+  OVERRIDE,
+} reflection_kind;
+
+// Module scope declaration the host refers to. The original name is copied,
+// the mangled one is read from the declaring token when writing.
+typedef struct reflection {
+  reflection_kind kind;
+  char *name;
+  const token_node *node;
+  const char *space; // Address space of resources, "handle" if none given
+  const char *stage; // Stage of entry points
+  long group;        // -1 if not given
+  long binding;
+  long id;           // @id of overrides
+  struct reflection *next;
+} reflection;
+
+// Records resources, entry points and overrides of the tokens, which have to
+// stay alive until the reflection is written.
+bool collect_reflection(const token_node *head, reflection **first);
+// Writes a C header if the file name ends with ".h", JSON otherwise
+bool write_reflection(const char *filename, const reflection *first);
+void free_reflection(reflection *first);
+
+#endif
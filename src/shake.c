@@ -0,0 +1,139 @@
+#include "shake.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minify.h"
+#include "syntax.h"
+#include "tokenize.h"
+
+struct module_declaration {
+  const token_node *first;
+  const token_node *last;
+  const char *name; // NULL for kept declarations
+  bool kept;
+  bool used;
+};
+
+// Directives, const_assert and tokens outside of declarations are kept
+bool is_kept_declaration(const token_node *keyword)
+{
+  return !keyword || is_kw(keyword, "enable") || is_kw(keyword, "requires") ||
+    is_kw(keyword, "diagnostic") || is_kw(keyword, "const_assert");
+}
+
+int compare_declaration_names(const void *a, const void *b)
+{
+  return strcmp((*(module_declaration * const *)a)->name,
+      (*(module_declaration * const *)b)->name);
+}
+
+bool collect_module_declarations(const token_node *head,
+    module_declarations *m)
+{
+  size_t count = 0;
+  for(const token_node *first = head; first;
+      first = declaration_end(first)->next)
+    count++;
+
+  m->decls = calloc(count ? count : 1, sizeof(*m->decls));
+  m->by_name = calloc(count ? count : 1, sizeof(*m->by_name));
+  m->pending = calloc(count ? count : 1, sizeof(*m->pending));
+  if(!m->decls || !m->by_name || !m->pending) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return true;
+  }
+
+  for(const token_node *first = head; first; m->count++) {
+    module_declaration *decl = &m->decls[m->count];
+    decl->first = first;
+    decl->last = declaration_end(first);
+    const token_node *keyword, *name;
+    find_declaration_name(decl->first, decl->last, &keyword, &name);
+    decl->kept = is_kept_declaration(keyword);
+    decl->name = name && !decl->kept ? node_value(name) : NULL;
+    if(decl->name)
+      m->by_name[m->named++] = decl;
+    first = decl->last->next;
+  }
+  qsort(m->by_name, m->named, sizeof(*m->by_name), compare_declaration_names);
+
+  return false;
+}
+
+module_declaration *find_module_declaration(const module_declarations *m,
+    const char *name)
+{
+  module_declaration key = { NULL, NULL, name, false, false };
+  module_declaration *k = &key;
+  module_declaration **found = bsearch(&k, m->by_name, m->named,
+      sizeof(*m->by_name), compare_declaration_names);
+  return found ? *found : NULL;
+}
+
+// Marks the declarations referred to by the pending ones until there are no
+// more. Member accesses are no references, local names shadowing module
+// scope ones keep the latter.
+void mark_used_declarations(module_declarations *m, size_t pending)
+{
+  while(pending > 0) {
+    const module_declaration *decl = m->pending[--pending];
+    for(const token_node *curr = decl->first; curr != decl->last->next;
+        curr = curr->next) {
+      if(curr->type != IDENTIFIER || is_sym(prev_sig(curr), "."))
+        continue;
+      module_declaration *ref = find_module_declaration(m, node_value(curr));
+      if(ref && !ref->used) {
+        ref->used = true;
+        m->pending[pending++] = ref;
+      }
+    }
+  }
+}
+
+bool copy_reachable(module_declarations *m, const char *entry_point,
+    token_node **copy)
+{
+  module_declaration *entry = find_module_declaration(m, entry_point);
+  if(!entry) {
+    fprintf(stderr, "Entry point '%s' not found\n", entry_point);
+    return true;
+  }
+
+  size_t pending = 0;
+  for(size_t i=0; i<m->count; i++) {
+    m->decls[i].used = m->decls[i].kept;
+    if(m->decls[i].kept)
+      m->pending[pending++] = &m->decls[i];
+  }
+  entry->used = true;
+  m->pending[pending++] = entry;
+  mark_used_declarations(m, pending);
+
+  bool error = false;
+  token_node *last = NULL;
+  *copy = NULL;
+  for(size_t i=0; !error && i<m->count; i++) {
+    if(m->decls[i].used) {
+      error = append_token_copies(m->decls[i].first, m->decls[i].last, &last);
+      // The first segment starts the copy
+      for(*copy = *copy ? *copy : last; !error && (*copy)->prev;)
+        *copy = (*copy)->prev;
+    }
+  }
+  if(error) {
+    free_token_nodes(*copy);
+    *copy = NULL;
+  } else
+    compress_whitespaces(copy);
+
+  return error;
+}
+
+void free_module_declarations(module_declarations *m)
+{
+  free(m->decls);
+  free(m->by_name);
+  free(m->pending);
+  *m = (module_declarations){ NULL, 0, NULL, 0, NULL };
+}
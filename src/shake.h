@@ -0,0 +1,29 @@
+#ifndef SHAKE_H
+#define SHAKE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct token_node token_node;
+typedef struct module_declaration module_declaration;
+
+// Module scope declarations of a module that is split by entry point. Zero
+// initialize before use, the tokens have to outlive the declarations.
+typedef struct module_declarations {
+  module_declaration *decls;
+  size_t count;
+  module_declaration **by_name; // Named declarations sorted by name
+  size_t named;
+  module_declaration **pending; // Used declarations not yet scanned
+} module_declarations;
+
+bool collect_module_declarations(const token_node *head,
+    module_declarations *m);
+// Copies the declarations reachable from the entry point with the given name.
+// Directives and const_assert are kept together with everything they refer
+// to, other entry points are left out.
+bool copy_reachable(module_declarations *m, const char *entry_point,
+    token_node **copy);
+void free_module_declarations(module_declarations *m);
+
+#endif
@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+#include "stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "memory.h"
+#include "tokenize.h"
+
+// File layout: header, token records, string offsets, string data. Values
+// are stored in native byte order, the header records it to reject streams
+// written on other machines.
+#define STREAM_MAGIC "WGSLTOK"
+#define STREAM_VERSION 2
+#define STREAM_BYTE_ORDER 0x01020304u
+
+typedef struct stream_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t token_count;
+  uint32_t string_count;
+  uint64_t strings_size;
+} stream_header;
+
+typedef struct stream_token {
+  uint32_t string; // Index of the value in the string table
+  uint32_t offset;
+  uint32_t length;
+  uint8_t type;
+  uint8_t flags; // HAS_NEWLINE of whitespace runs
+  uint8_t reserved[2];
+} stream_token;
+
+typedef struct string_table {
+  const char **strings;
+  uint32_t *offsets;
+  size_t count;
+  size_t capacity;
+  uint32_t *slots; // Hash slots holding string index + 1, 0 if empty
+  size_t slot_count;
+  uint64_t size;
+} string_table;
+
+size_t hash_string(const char *str)
+{
+  size_t h = 14695981039346656037u;
+  while(*str)
+    h = (h ^ (unsigned char)*str++) * 1099511628211u;
+  return h;
+}
+
+uint32_t *find_string_slot(const string_table *table, const char *str)
+{
+  size_t mask = table->slot_count - 1;
+  size_t i = hash_string(str) & mask;
+  while(table->slots[i] && strcmp(table->strings[table->slots[i] - 1], str) != 0)
+    i = (i + 1) & mask;
+  return &table->slots[i];
+}
+
+bool grow_string_table(string_table *table)
+{
+  size_t capacity = table->capacity ? 2 * table->capacity : 256;
+  const char **strings = realloc(table->strings, capacity * sizeof(*strings));
+  if(strings)
+    table->strings = strings;
+  uint32_t *offsets = realloc(table->offsets, capacity * sizeof(*offsets));
+  if(offsets)
+    table->offsets = offsets;
+  uint32_t *slots = calloc(2 * capacity, sizeof(*slots));
+  if(!strings || !offsets || !slots) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(slots);
+    return true;
+  }
+
+  free(table->slots);
+  table->slots = slots;
+  table->slot_count = 2 * capacity;
+  table->capacity = capacity;
+  for(size_t i=0; i<table->count; i++)
+    *find_string_slot(table, table->strings[i]) = i + 1;
+
+  return false;
+}
+
+bool intern_string(string_table *table, const char *str, uint32_t *index)
+{
+  if(table->count == table->capacity && grow_string_table(table))
+    return true;
+
+  uint32_t *slot = find_string_slot(table, str);
+  if(!*slot) {
+    size_t len = strlen(str) + 1;
+    if(table->size + len > UINT32_MAX) {
+      fprintf(stderr, "Token stream too large\n");
+      return true;
+    }
+    table->strings[table->count] = str;
+    table->offsets[table->count] = table->size;
+    table->size += len;
+    *slot = ++table->count;
+  }
+  *index = *slot - 1;
+
+  return false;
+}
+
+bool write_token_stream(const char *filename, const token_node *head)
+{
+  size_t token_count = 0;
+  for(const token_node *curr = head; curr; curr = curr->next)
+    token_count++;
+  if(token_count > UINT32_MAX) {
+    fprintf(stderr, "Token stream too large\n");
+    return true;
+  }
+
+  string_table table = { NULL, NULL, 0, 0, NULL, 0, 0 };
+  stream_token *tokens = calloc(token_count ? token_count : 1, sizeof(*tokens));
+  bool error = !tokens;
+  if(error)
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+
+  size_t i = 0;
+  for(const token_node *curr = head; !error && curr; curr = curr->next, i++) {
+    if(curr->offset > UINT32_MAX || curr->length > UINT32_MAX) {
+      fprintf(stderr, "Token stream too large\n");
+      error = true;
+      break;
+    }
+    error = intern_string(&table, ((token *)curr->token)->value,
+        &tokens[i].string);
+    tokens[i].offset = curr->offset;
+    tokens[i].length = curr->length;
+    tokens[i].type = curr->type;
+    tokens[i].flags = curr->flags & HAS_NEWLINE;
+  }
+
+  FILE *file = NULL;
+  if(!error) {
+    file = fopen(filename, "wb");
+    if(!file) {
+      fprintf(stderr, "Failed to open '%s': %s\n", filename, strerror(errno));
+      error = true;
+    }
+  }
+
+  if(!error) {
+    stream_header header = { STREAM_MAGIC, STREAM_VERSION, STREAM_BYTE_ORDER,
+      token_count, table.count, table.size };
+    error = fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(tokens, sizeof(*tokens), token_count, file) != token_count ||
+      fwrite(table.offsets, sizeof(*table.offsets), table.count, file) !=
+        table.count;
+    for(size_t j=0; !error && j<table.count; j++)
+      error = fputs(table.strings[j], file) == EOF || fputc('\0', file) == EOF;
+    if(error)
+      fprintf(stderr, "Failed to write '%s': %s\n", filename, strerror(errno));
+  }
+
+  if(file && fclose(file) != 0) {
+    fprintf(stderr, "Failed to close file: %s\n", strerror(errno));
+    error = true;
+  }
+
+  free(tokens);
+  free(table.strings);
+  free(table.offsets);
+  free(table.slots);
+
+  return error;
+}
+
+bool map_file(const char *filename, void **map, size_t *size)
+{
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) {
+    fprintf(stderr, "Failed to open '%s': %s\n", filename, strerror(errno));
+    return true;
+  }
+
+  struct stat st;
+  bool error = fstat(fd, &st) != 0;
+  if(!error && st.st_size > 0) {
+    // Values are never written, passes replace them by owned copies
+    *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    error = *map == MAP_FAILED;
+  } else
+    *map = NULL;
+  *size = error ? 0 : (size_t)st.st_size;
+  if(error)
+    fprintf(stderr, "Failed to map '%s': %s\n", filename, strerror(errno));
+  close(fd);
+
+  return error;
+}
+
+bool is_valid_stream(const void *map, size_t size)
+{
+  if(size < sizeof(stream_header))
+    return false;
+
+  const stream_header *header = map;
+  uint64_t expected = sizeof(*header) +
+    (uint64_t)header->token_count * sizeof(stream_token) +
+    (uint64_t)header->string_count * sizeof(uint32_t) + header->strings_size;
+  if(memcmp(header->magic, STREAM_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != STREAM_VERSION ||
+      header->byte_order != STREAM_BYTE_ORDER || expected != size)
+    return false;
+
+  const stream_token *tokens = (const stream_token *)(header + 1);
+  const uint32_t *offsets = (const uint32_t *)(tokens + header->token_count);
+  const char *strings = (const char *)(offsets + header->string_count);
+  if(header->strings_size > 0 && strings[header->strings_size - 1] != '\0')
+    return false;
+  for(size_t i=0; i<header->string_count; i++)
+    if(offsets[i] >= header->strings_size)
+      return false;
+  for(size_t i=0; i<header->token_count; i++)
+    if(tokens[i].string >= header->string_count || tokens[i].type > DIRECTIVE)
+      return false;
+
+  return true;
+}
+
+bool load_token_stream(const char *filename, token_stream *stream,
+    token_node **head)
+{
+  *stream = (token_stream){ NULL, 0, NULL, NULL, 0 };
+  if(map_file(filename, &stream->map, &stream->map_size))
+    return true;
+
+  if(!is_valid_stream(stream->map, stream->map_size)) {
+    fprintf(stderr, "'%s' is not a valid token stream\n", filename);
+    free_token_stream(stream);
+    return true;
+  }
+
+  const stream_header *header = stream->map;
+  const stream_token *tokens = (const stream_token *)(header + 1);
+  const uint32_t *offsets = (const uint32_t *)(tokens + header->token_count);
+  char *strings = (char *)(offsets + header->string_count);
+  size_t count = header->token_count;
+  if(count == 0) {
+    *head = NULL;
+    return false;
+  }
+
+  stream->count = count;
+  stream->nodes = mem_alloc(MEM_TOKENS, count * sizeof(*stream->nodes));
+  stream->tokens = mem_alloc(MEM_TOKENS, count * sizeof(*stream->tokens));
+  if(!stream->nodes || !stream->tokens) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free_token_stream(stream);
+    return true;
+  }
+
+  for(size_t i=0; i<count; i++) {
+    stream->tokens[i] = (identifier_token){ strings + offsets[tokens[i].string],
+      NULL, PLAIN, NULL };
+    stream->nodes[i] = (token_node){ &stream->tokens[i], tokens[i].type,
+      NODE_POOLED | VALUE_BORROWED | (tokens[i].flags & HAS_NEWLINE),
+      tokens[i].offset, tokens[i].length,
+      i > 0 ? &stream->nodes[i - 1] : NULL,
+      i + 1 < count ? &stream->nodes[i + 1] : NULL };
+  }
+  *head = stream->nodes;
+
+  return false;
+}
+
+void free_token_stream(token_stream *stream)
+{
+  if(stream->map)
+    munmap(stream->map, stream->map_size);
+  mem_free(MEM_TOKENS, stream->nodes, stream->count * sizeof(*stream->nodes));
+  mem_free(MEM_TOKENS, stream->tokens, stream->count * sizeof(*stream->tokens));
+  *stream = (token_stream){ NULL, 0, NULL, NULL, 0 };
+}
@@ -0,0 +1,28 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct token_node token_node;
+typedef struct identifier_token identifier_token;
+
+// Token list loaded from a binary token stream. Nodes and tokens are pooled
+// and values point into the mapped file, so loading does not allocate per
+// token. The stream has to outlive all of its token nodes.
+typedef struct token_stream {
+  void *map;
+  size_t map_size;
+  token_node *nodes;
+  identifier_token *tokens;
+  size_t count;
+} token_stream;
+
+// Writes types, source spans and values of the tokens. Values are stored once
+// in a string table, so equal identifiers share the same string id.
+bool write_token_stream(const char *filename, const token_node *head);
+bool load_token_stream(const char *filename, token_stream *stream,
+    token_node **head);
+void free_token_stream(token_stream *stream);
+
+#endif
@@ -0,0 +1,189 @@
+#include "syntax.h"
+#include <string.h>
+#include "tokenize.h"
+
+const char *node_value(const token_node *node)
+{
+  return ((token *)node->token)->value;
+}
+
+bool is_sym(const token_node *node, const char *symbol)
+{
+  return node && node->type == SYMBOL && strcmp(node_value(node), symbol) == 0;
+}
+
+bool is_kw(const token_node *node, const char *keyword)
+{
+  return node && node->type == KEYWORD && strcmp(node_value(node), keyword) == 0;
+}
+
+const token_node *next_sig(const token_node *node)
+{
+  node = node ? node->next : NULL;
+  while(node && (node->type == WHITESPACE || node->type == COMMENT))
+    node = node->next;
+  return node;
+}
+
+const token_node *prev_sig(const token_node *node)
+{
+  node = node ? node->prev : NULL;
+  while(node && (node->type == WHITESPACE || node->type == COMMENT))
+    node = node->prev;
+  return node;
+}
+
+// Number of template brackets the symbol opens (> 0) or closes (< 0)
+int template_delta(const token_node *node)
+{
+  if(is_sym(node, "<"))
+    return 1;
+  if(is_sym(node, ">"))
+    return -1;
+  if(is_sym(node, ">>"))
+    return -2;
+  return 0;
+}
+
+const token_node *find_open(const token_node *close, const char *open_sym,
+    const char *close_sym)
+{
+  int depth = 0;
+  for(const token_node *curr = close; curr; curr = prev_sig(curr)) {
+    if(is_sym(curr, close_sym))
+      depth++;
+    else if(is_sym(curr, open_sym) && --depth == 0)
+      return curr;
+  }
+  return NULL;
+}
+
+const token_node *find_close(const token_node *open, const char *open_sym,
+    const char *close_sym)
+{
+  int depth = 0;
+  for(const token_node *curr = open; curr; curr = next_sig(curr)) {
+    if(is_sym(curr, open_sym))
+      depth++;
+    else if(is_sym(curr, close_sym) && --depth == 0)
+      return curr;
+  }
+  return NULL;
+}
+
+const token_node *find_template_open(const token_node *close)
+{
+  int depth = 0;
+  for(const token_node *curr = close; curr; curr = prev_sig(curr)) {
+    depth -= template_delta(curr);
+    if(depth <= 0)
+      return curr;
+  }
+  return NULL;
+}
+
+// Returns the first token of the template argument with the given index
+const token_node *template_arg(const token_node *type, size_t index)
+{
+  const token_node *curr = next_sig(type);
+  if(!is_sym(curr, "<"))
+    return NULL;
+  int depth = 1, parens = 0;
+  curr = next_sig(curr);
+  while(curr && index > 0) {
+    depth += template_delta(curr);
+    if(is_sym(curr, "("))
+      parens++;
+    else if(is_sym(curr, ")"))
+      parens--;
+    if(depth <= 0)
+      return NULL;
+    if(depth == 1 && parens == 0 && is_sym(curr, ","))
+      index--;
+    curr = next_sig(curr);
+  }
+  return curr;
+}
+
+// Skips a type and returns the token following it
+const token_node *skip_type(const token_node *type)
+{
+  const token_node *curr = next_sig(type);
+  if(!is_sym(curr, "<"))
+    return curr;
+  int depth = 0;
+  while(curr) {
+    depth += template_delta(curr);
+    curr = next_sig(curr);
+    if(depth <= 0)
+      break;
+  }
+  return curr;
+}
+
+// Skips attributes like @location(0) and returns the token following them
+const token_node *skip_attributes(const token_node *node)
+{
+  while(is_sym(node, "@")) {
+    node = next_sig(next_sig(node));
+    if(is_sym(node, "(")) {
+      int depth = 0;
+      do {
+        if(is_sym(node, "("))
+          depth++;
+        else if(is_sym(node, ")"))
+          depth--;
+        node = next_sig(node);
+      } while(node && depth > 0);
+    }
+  }
+  return node;
+}
+
+const char *declaration_keywords[] = { "alias", "const", "const_assert",
+  "diagnostic", "enable", "fn", "override", "requires", "struct", "var", NULL };
+
+// Last token of the module scope declaration starting at first. Whitespace
+// and comments in front of a declaration belong to it.
+const token_node *declaration_end(const token_node *first)
+{
+  int depth = 0;
+  for(const token_node *curr = first; curr; curr = curr->next) {
+    if(is_sym(curr, "{"))
+      depth++;
+    else if((is_sym(curr, "}") && --depth <= 0) ||
+        (is_sym(curr, ";") && depth <= 0) || !curr->next)
+      return curr;
+  }
+  return NULL;
+}
+
+bool is_declaration_keyword(const token_node *node)
+{
+  if(node->type != KEYWORD || is_sym(prev_sig(node), "@"))
+    return false;
+  for(const char **kw = declaration_keywords; *kw; kw++)
+    if(strcmp(node_value(node), *kw) == 0)
+      return true;
+  return false;
+}
+
+// Finds the declaring keyword and the declared name of a declaration span
+void find_declaration_name(const token_node *first, const token_node *last,
+    const token_node **keyword, const token_node **name)
+{
+  *keyword = NULL;
+  *name = NULL;
+  for(const token_node *curr = first; curr != last->next; curr = curr->next) {
+    if(is_declaration_keyword(curr)) {
+      *keyword = curr;
+      break;
+    }
+  }
+
+  const token_node *next = next_sig(*keyword);
+  if(is_sym(next, "<"))
+    next = next_sig(find_close(next, "<", ">"));
+  if(next && next->type == IDENTIFIER)
+    *name = next;
+}
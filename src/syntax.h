@@ -0,0 +1,36 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct token_node token_node;
+
+// Helpers to navigate the token stream. Whitespace and comments are skipped
+// by all functions except node_value().
+
+const char *node_value(const token_node *node);
+bool is_sym(const token_node *node, const char *symbol);
+bool is_kw(const token_node *node, const char *keyword);
+const token_node *next_sig(const token_node *node);
+const token_node *prev_sig(const token_node *node);
+
+int template_delta(const token_node *node);
+const token_node *find_open(const token_node *close, const char *open_sym,
+    const char *close_sym);
+const token_node *find_close(const token_node *open, const char *open_sym,
+    const char *close_sym);
+const token_node *find_template_open(const token_node *close);
+const token_node *template_arg(const token_node *type, size_t index);
+const token_node *skip_type(const token_node *type);
+const token_node *skip_attributes(const token_node *node);
+
+// Module scope declarations are split at ';' and '}' outside of braces, the
+// whitespace and comments in front of a declaration belong to it.
+const token_node *declaration_end(const token_node *first);
+// Finds the declaring keyword and the declared name of a declaration, both
+// are NULL if there is none
+void find_declaration_name(const token_node *first, const token_node *last,
+    const token_node **keyword, const token_node **name);
+
+#endif
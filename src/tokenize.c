@@ -1,30 +1,73 @@
 #include "tokenize.h"
-#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "buffer.h"
+#include "charclass.h"
 #include "keywords.h"
+#include "memory.h"
+#include "parallel.h"
+#include "trace.h"
+#include "unicode.h"
+
+// Inputs are only split into chunks of at least this size
+#define MIN_CHUNK_SIZE (64 << 10)
 
 typedef bool (*func_is)(char, size_t);
 
+typedef struct chunk {
+  const char *src;
+  size_t len;
+  size_t start;
+  size_t end;
+  token_node *head;
+  token_node *last;
+  token_arena *arena;
+  bool error;
+} chunk;
+
 bool is_name(char c, size_t pos)
 {
-  return isalpha(c) != 0 || c == '_' || (pos > 0 && isdigit(c) != 0);
+  return has_class(c, pos == 0 ? CC_NAME_START : CC_NAME);
+}
+
+// Length of the name starting at pos, 0 if there is none. Names are scanned
+// by character class until a non-ASCII byte, only then UTF-8 is decoded.
+size_t scan_name(const char *src, size_t len, size_t pos)
+{
+  size_t i = pos;
+  while(i < len && is_name(src[i], i - pos))
+    i++;
+
+  uint32_t cp;
+  size_t n;
+  while(i < len && (unsigned char)src[i] >= 0x80 &&
+      (n = decode_utf8(src, len, i, &cp)) > 0 &&
+      (i == pos ? is_xid_start(cp) : is_xid_continue(cp))) {
+    i += n;
+    while(i < len && is_name(src[i], i - pos))
+      i++;
+  }
+
+  return i - pos;
+}
+
+bool is_space(char c, size_t pos)
+{
+  (void)pos;
+  return has_class(c, CC_SPACE);
 }
 
 bool is_number(char c, size_t pos)
 {
-  if(pos == 0 && !(isdigit(c) != 0 || c == '.'))
-    return false;
+  if(pos == 0)
+    return has_class(c, CC_NUM_START);
 
   if(pos == 1 && (c == 'x' || c == 'X'))
     return true;
 
-  return isdigit(c) != 0 || c == '.' || c == 'i' || c == 'u' || c == 'h' ||
-    (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') || c == 'p' || c == 'P' ||
-    c == '+' || c == '-';
+  return has_class(c, CC_NUM);
 }
 
 bool is_symbol(const char *symbol)
@@ -43,142 +86,304 @@ bool is_keyword(const char *name)
   return false;
 }
 
-int peek(FILE *file)
+int char_at(const char *src, size_t len, size_t pos)
 {
-  return ungetc(fgetc(file), file);
+  return pos < len ? (unsigned char)src[pos] : EOF;
 }
 
-bool read_until(FILE *file, char **dst, const char *delimiter)
+// Length up to and including the delimiter. A newline delimiter is not
+// included.
+size_t scan_until(const char *src, size_t len, size_t pos, const char *delimiter)
 {
+  const char *end = NULL;
   size_t delimiter_size = strlen(delimiter);
-  size_t delimiter_pos = 0;
-  int c;
-  bool error = false;
-  buffer buf = { NULL, 0, 0 };
-  
-  while(!error && delimiter_pos < delimiter_size && (c = fgetc(file)) != EOF) {
-    error = write_buf(&buf, c);
-    if(c != delimiter[delimiter_pos])
-      delimiter_pos = 0;
-    if(c == delimiter[delimiter_pos])
-      delimiter_pos++;
+  for(size_t i=pos; i + delimiter_size <= len && !end; i++)
+    if(memcmp(src + i, delimiter, delimiter_size) == 0)
+      end = src + i;
+
+  if(!end)
+    return len - pos;
+
+  if(delimiter_size == 1 && delimiter[0] == '\n')
+    return end - (src + pos);
+
+  return end - (src + pos) + delimiter_size;
+}
+
+size_t scan_is(const char *src, size_t len, size_t pos, func_is is)
+{
+  size_t i = 0;
+  while(pos + i < len && is(src[pos + i], i))
+    i++;
+  return i;
+}
+
+// Length of the longest symbol starting at pos, 0 if there is none
+size_t scan_symbol(const char *src, size_t len, size_t pos)
+{
+  char symbol[8];
+  size_t symbol_len = 0;
+  while(symbol_len < max_symbol_len && pos + symbol_len < len &&
+      has_class(src[pos + symbol_len], CC_PUNCT)) {
+    symbol[symbol_len] = src[pos + symbol_len];
+    symbol_len++;
   }
-  
-  if(error) {
-    free(buf.ptr);
-    return true;
+
+  while(symbol_len > 0) {
+    symbol[symbol_len] = '\0';
+    if(is_symbol(symbol))
+      break;
+    symbol_len--;
   }
-  
-  if(delimiter_size == 1 && delimiter[0] == '\n' && delimiter_pos == 1) {
-    ungetc(c, file);
-    buf.pos--;
+
+  return symbol_len;
+}
+
+// Length of a (nested) block comment including the final '/'
+size_t scan_block_comment(const char *src, size_t len, size_t pos)
+{
+  int comment_beg_cnt = 0;
+  size_t i = pos;
+  do {
+    int c = char_at(src, len, i++);
+    if(c == '/' && char_at(src, len, i) == '*')
+      comment_beg_cnt++;
+    else if(c == '*' && char_at(src, len, i) == '/')
+      comment_beg_cnt--;
+  } while(i < len && comment_beg_cnt > 0);
+
+  if(i < len)
+    i++;
+
+  return i - pos;
+}
+
+// Blocks are at least this size, larger allocations get their own block
+#define ARENA_BLOCK_SIZE (64 << 10)
+#define ARENA_ALIGN _Alignof(token_node)
+
+typedef struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  unsigned char data[];
+} arena_block;
+
+struct token_arena {
+  arena_block *blocks;
+  arena_block *spare; // Empty blocks kept by reset_token_arena()
+  const char **slots; // Interned values, open addressing
+  size_t slot_count;
+  size_t value_count;
+  token_arena *children; // Arenas of the threads of the parallel tokenizer
+  token_arena *next;
+};
+
+// Arena new tokens are allocated from, NULL to allocate them individually
+_Thread_local token_arena *current_arena = NULL;
+
+token_arena *create_token_arena(void)
+{
+  token_arena *arena = mem_alloc(MEM_TOKENS, sizeof(*arena));
+  if(!arena) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    return NULL;
   }
-  
-  *dst = buf_to_str(&buf, true);
-  
-  return !*dst;
+  *arena = (token_arena){ NULL, NULL, NULL, 0, 0, NULL, NULL };
+  return arena;
 }
 
-bool read_until_is(FILE *file, char **dst, func_is is)
-{ 
-  int c;
-  bool error = false;
-  buffer buf = { NULL, 0, 0 };
-  
-  while(!error && (c = fgetc(file)) != EOF && is(c, buf.pos))
-    error = write_buf(&buf, c);
-  
-  if(error) {
-    free(buf.ptr);
-    return true;
+void set_token_arena(token_arena *arena)
+{
+  current_arena = arena;
+}
+
+void free_arena_blocks(arena_block *block)
+{
+  while(block) {
+    arena_block *next = block->next;
+    mem_free(MEM_TOKENS, block, sizeof(*block) + block->size);
+    block = next;
   }
-  
-  if(c != EOF)
-    ungetc(c, file);
-  
-  *dst = buf_to_str(&buf, true);
-  
-  return !*dst;
 }
 
-bool read_symbol(FILE *file, char **symbol)
+void free_arena_children(token_arena *arena)
 {
-  int c;
-  buffer buf = { NULL, 0, 0 };
-  
-  while(buf.pos < max_symbol_len && (c = fgetc(file)) != EOF &&
-      ispunct(c) != 0) {
-    if(write_buf(&buf, c)) {
-      free(buf.ptr);
-      return true;
-    }
+  while(arena->children) {
+    token_arena *next = arena->children->next;
+    free_token_arena(arena->children);
+    arena->children = next;
   }
+}
 
-  if(buf.pos < max_symbol_len && c != EOF)
-    ungetc(c, file);
+void reset_token_arena(token_arena *arena)
+{
+  free_arena_children(arena);
+  while(arena->blocks) {
+    arena_block *next = arena->blocks->next;
+    if(arena->blocks->size == ARENA_BLOCK_SIZE) {
+      arena->blocks->used = 0;
+      arena->blocks->next = arena->spare;
+      arena->spare = arena->blocks;
+    } else
+      mem_free(MEM_TOKENS, arena->blocks,
+          sizeof(*arena->blocks) + arena->blocks->size);
+    arena->blocks = next;
+  }
+  for(size_t i=0; i<arena->slot_count; i++)
+    arena->slots[i] = NULL;
+  arena->value_count = 0;
+}
 
-  *symbol = buf_to_str(&buf, true);
-  if(!*symbol)
-    return true;
+void free_token_arena(token_arena *arena)
+{
+  if(!arena)
+    return;
+
+  free_arena_children(arena);
+  free_arena_blocks(arena->blocks);
+  free_arena_blocks(arena->spare);
+  mem_free(MEM_TOKENS, arena->slots, arena->slot_count * sizeof(*arena->slots));
+  mem_free(MEM_TOKENS, arena, sizeof(*arena));
+}
 
-  size_t symbol_len = strlen(*symbol);
-  while(symbol_len > 0 && !is_symbol(*symbol)) {
-    symbol_len--;
-    ungetc((*symbol)[symbol_len], file);
-    (*symbol)[symbol_len] = '\0';
-  }
-  
-  if(symbol_len == 0) {
-    free(*symbol);
-    *symbol = NULL;
+void *arena_alloc(token_arena *arena, size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  arena_block *block = arena->blocks;
+  if(!block || block->size - block->used < size) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    if(arena->spare && block_size == ARENA_BLOCK_SIZE) {
+      block = arena->spare;
+      arena->spare = block->next;
+    } else {
+      block = mem_alloc(MEM_TOKENS, sizeof(*block) + block_size);
+      if(!block) {
+        fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+        return NULL;
+      }
+      block->size = block_size;
+      block->used = 0;
+    }
+    // Keep the partly used block in front if the new one is filled up
+    if(arena->blocks && block_size > ARENA_BLOCK_SIZE) {
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    } else {
+      block->next = arena->blocks;
+      arena->blocks = block;
+    }
   }
 
-  return false;
+  void *ptr = block->data + block->used;
+  block->used += size;
+
+  return ptr;
 }
 
-bool read_block_comment(FILE *file, char **comment)
+size_t hash_value(const char *value, size_t len)
 {
-  int c;
-  int comment_beg_cnt = 0;
-  bool error = false;
-  buffer buf = { NULL, 0, 0 };
-  
-  do {
-    c = fgetc(file);
-    if(c == '/' && peek(file) == '*')
-      comment_beg_cnt++;
-    else if(c == '*' && peek(file) == '/')
-      comment_beg_cnt--;
-    error = write_buf(&buf, c);
-  } while(!error && c != EOF && comment_beg_cnt > 0);
+  size_t h = 14695981039346656037u;
+  for(size_t i=0; i<len; i++)
+    h = (h ^ (unsigned char)value[i]) * 1099511628211u;
+  return h;
+}
 
-  if(!error && c != EOF) {
-    c = fgetc(file);
-    if(c != EOF)
-      error = write_buf(&buf, c);
+const char **find_value_slot(const token_arena *arena, const char *value,
+    size_t len)
+{
+  size_t mask = arena->slot_count - 1;
+  size_t i = hash_value(value, len) & mask;
+  while(arena->slots[i] && (strncmp(arena->slots[i], value, len) != 0 ||
+        arena->slots[i][len] != '\0'))
+    i = (i + 1) & mask;
+  return &arena->slots[i];
+}
+
+// Returns the arena's copy of the value, equal values are stored once
+char *intern_value(token_arena *arena, const char *value, size_t len)
+{
+  if(2 * (arena->value_count + 1) > arena->slot_count) {
+    size_t slot_count = arena->slot_count ? 2 * arena->slot_count : 1024;
+    const char **slots = mem_alloc(MEM_TOKENS, slot_count * sizeof(*slots));
+    if(!slots) {
+      fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+      return NULL;
+    }
+    for(size_t i=0; i<slot_count; i++)
+      slots[i] = NULL;
+    token_arena grown = *arena;
+    grown.slots = slots;
+    grown.slot_count = slot_count;
+    for(size_t i=0; i<arena->slot_count; i++)
+      if(arena->slots[i])
+        *find_value_slot(&grown, arena->slots[i], strlen(arena->slots[i])) =
+          arena->slots[i];
+    mem_free(MEM_TOKENS, arena->slots, arena->slot_count * sizeof(*arena->slots));
+    arena->slots = slots;
+    arena->slot_count = slot_count;
   }
 
-  if(error) {
-    free(buf.ptr);
-    *comment = NULL;
-    return true;
+  const char **slot = find_value_slot(arena, value, len);
+  if(!*slot) {
+    char *copy = arena_alloc(arena, len + 1);
+    if(!copy)
+      return NULL;
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+    *slot = copy;
+    arena->value_count++;
   }
 
-  return (*comment = buf_to_str(&buf, true)) == NULL;
+  return (char *)*slot;
 }
 
-token_node *create_token_node(token_node *last, enum token_type type, void *token)
+// Allocates from the current arena if there is one
+void *alloc_token_mem(size_t size)
 {
-  token_node *tn = malloc(sizeof(*tn));
-  if(!tn) {
+  void *ptr = current_arena ? arena_alloc(current_arena, size) :
+    mem_alloc(MEM_TOKENS, size);
+  if(!ptr && !current_arena)
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+  return ptr;
+}
+
+void free_token_mem(void *ptr, size_t size)
+{
+  if(!current_arena)
+    mem_free(MEM_TOKENS, ptr, size);
+}
+
+char *copy_token_value(const char *value, size_t len)
+{
+  if(current_arena)
+    return intern_value(current_arena, value, len);
+
+  char *copy = mem_strndup(MEM_TOKENS, value, len);
+  if(!copy)
     fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+  return copy;
+}
+
+// Size of the token struct of a node, the type of a node never changes
+size_t token_size(enum token_type type)
+{
+  return type == IDENTIFIER ? sizeof(identifier_token) : sizeof(token);
+}
+
+token_node *create_token_node(token_node *last, enum token_type type, void *token)
+{
+  token_node *tn = alloc_token_mem(sizeof(*tn));
+  if(!tn)
     return NULL;
-  }
 
   tn->type = type;
   tn->token = token;
   tn->prev = last;
   tn->next = NULL;
+  tn->offset = 0;
+  tn->length = 0;
+  tn->flags = current_arena ? NODE_POOLED | VALUE_BORROWED : 0;
   
   if(last)
     last->next = tn;
@@ -186,56 +391,53 @@ token_node *create_token_node(token_node *last, enum token_type type, void *toke
   return tn;
 }
 
-token *create_token(const char *value)
+token *create_token(const char *value, size_t len)
 {
-  token *t = malloc(sizeof(*t));
-  if(!t) {
-    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+  token *t = alloc_token_mem(sizeof(*t));
+  if(!t)
     return NULL;
-  }
 
-  t->value = strdup(value);
+  t->value = copy_token_value(value, len);
   if(!t->value) {
-    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
-    free(t);
+    free_token_mem(t, sizeof(*t));
     return NULL;
   }
   
   return t;
 }
 
-identifier_token *create_identifier_token(const char *value)
+identifier_token *create_identifier_token(const char *value, size_t len)
 {
-  identifier_token *t = malloc(sizeof(*t));
-  if(!t) {
-    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+  identifier_token *t = alloc_token_mem(sizeof(*t));
+  if(!t)
     return NULL;
-  }
 
-  t->value = strdup(value);
+  t->value = copy_token_value(value, len);
   if(!t->value) {
-    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
-    free(t);
+    free_token_mem(t, sizeof(*t));
     return NULL;
   }
 
   t->data = NULL;
+  t->access = PLAIN;
+  t->owner = NULL;
   
   return t;
 }
 
-bool create_token_node_with_token(token_node **last, enum token_type type, const char *value)
+bool create_token_node_with_value(token_node **last, enum token_type type,
+    const char *value, size_t len)
 {
-  void *t = NULL;
-  if(value) {
-    t = (type == IDENTIFIER) ? (void *)create_identifier_token(value) : (void *)create_token(value);
-    if(!t)
-      return true;
-  }
+  void *t = type == IDENTIFIER ? (void *)create_identifier_token(value, len) :
+    (void *)create_token(value, len);
+  if(!t)
+    return true;
 
   token_node *tn = create_token_node(*last, type, t);
   if(!tn) {
-    free(t);
+    if(!current_arena)
+      mem_free(MEM_TOKENS, ((token *)t)->value, len + 1);
+    free_token_mem(t, token_size(type));
     return true;
   }
 
@@ -244,6 +446,11 @@ bool create_token_node_with_token(token_node **last, enum token_type type, const
   return false;
 }
 
+bool create_token_node_with_token(token_node **last, enum token_type type, const char *value)
+{
+  return create_token_node_with_value(last, type, value, strlen(value));
+}
+
 void print_tokens(const token_node *head)
 {
   while(head) {
@@ -254,6 +461,9 @@ void print_tokens(const token_node *head)
       case SUBSTITUTION:
         printf("substitution: %s\n", ((token *)head->token)->value);
         break;
+      case DIRECTIVE:
+        printf("directive: %s\n", ((token *)head->token)->value);
+        break;
       case COMMENT:
         printf("comment: %s\n", ((token *)head->token)->value);
         break;
@@ -277,37 +487,73 @@ void print_tokens(const token_node *head)
 }
 
 void print_tokens_as_text(const token_node *head)
+{
+  write_tokens_as_text(stdout, head);
+}
+
+void write_tokens_as_text(FILE *file, const token_node *head)
 {
   while(head) {
      switch(head->type) {
       case WHITESPACE:
       case COMMENT:
       case SUBSTITUTION:
+      case DIRECTIVE:
       case KEYWORD:
       case LITERAL:
       case SYMBOL:
-        printf("%s", ((token *)head->token)->value);
+        fprintf(file, "%s", ((token *)head->token)->value);
         break;
       case IDENTIFIER:
-        printf("%s", ((identifier_token *)head->token)->value);
+        fprintf(file, "%s", ((identifier_token *)head->token)->value);
         break;
       default:
-        printf("<< UNKNOWN TOKEN >>");
+        fprintf(file, "<< UNKNOWN TOKEN >>");
     }
     head = head->next;
   }
-  printf("\n");
+  fprintf(file, "\n");
 }
 
-void free_token_node(token_node *node)
+// Replaces the value by a copy of len characters of the given one, which may
+// point into the current value
+bool set_token_value(token_node *node, const char *value, size_t len)
 {
-  if(node->type == IDENTIFIER)
-    free(((identifier_token *)node->token)->value);
+  char *copy = copy_token_value(value, len);
+  if(!copy)
+    return true;
+
+  token *t = (token *)node->token;
+  if(!(node->flags & VALUE_BORROWED))
+    mem_free(MEM_TOKENS, t->value, strlen(t->value) + 1);
+  t->value = copy;
+  if(current_arena)
+    node->flags |= VALUE_BORROWED;
   else
-    free(((token *)node->token)->value);
-  
-  free(node->token);
-  free(node);
+    node->flags &= ~VALUE_BORROWED;
+
+  return false;
+}
+
+void share_token_value(token_node *node, char *value)
+{
+  token *t = (token *)node->token;
+  if(!(node->flags & VALUE_BORROWED))
+    mem_free(MEM_TOKENS, t->value, strlen(t->value) + 1);
+  t->value = value;
+  node->flags |= VALUE_BORROWED;
+}
+
+void free_token_node(token_node *node)
+{
+  token *t = (token *)node->token;
+  if(!(node->flags & VALUE_BORROWED))
+    mem_free(MEM_TOKENS, t->value, strlen(t->value) + 1);
+
+  if(!(node->flags & NODE_POOLED)) {
+    mem_free(MEM_TOKENS, t, token_size(node->type));
+    mem_free(MEM_TOKENS, node, sizeof(*node));
+  }
 }
 
 void free_token_nodes(token_node *head)
@@ -319,114 +565,367 @@ void free_token_nodes(token_node *head)
   }
 }
 
-bool tokenize(FILE *file, token_node **head)
+// Replaces the nodes from first to last by the list repl (may be NULL)
+void splice_nodes(token_node **head, token_node *first, token_node *last,
+    token_node *repl)
 {
-  bool error = false;
-  token_node *last = *head;
-  int c;
+  token_node *prev = first->prev, *next = last->next;
+  token_node *repl_last = repl;
+  while(repl_last && repl_last->next)
+    repl_last = repl_last->next;
+
+  if(repl) {
+    repl->prev = prev;
+    repl_last->next = next;
+  }
+  if(prev)
+    prev->next = repl ? repl : next;
+  else
+    *head = repl ? repl : next;
+  if(next)
+    next->prev = repl ? repl_last : prev;
 
-  while(!error && (c = fgetc(file)) != EOF) {
+  first->prev = NULL;
+  last->next = NULL;
+  free_token_nodes(first);
+}
 
-    if(isspace(c) != 0) {
-      error = create_token_node_with_token(&last, WHITESPACE, " ");
-      continue;
-    }
-   
-    if(c == '$' && peek(file) == '{') {
-      ungetc(c, file);
-      char *subst;
-      error = read_until(file, &subst, "}");
-      if(!error)
-        error = create_token_node_with_token(&last, SUBSTITUTION, subst);
-      free(subst);
-      continue;
-    }
+bool create_token_node_from_src(token_node **last, enum token_type type,
+    const char *src, size_t pos, size_t len)
+{
+  bool error = create_token_node_with_value(last, type, src + pos, len);
+  if(!error) {
+    (*last)->offset = pos;
+    (*last)->length = len;
+  }
 
-    if(c == '/' && peek(file) == '/') {
-      ungetc(c, file);
-      char *comment = NULL;
-      error = read_until(file, &comment, "\n");
-      if(comment) {
-        error = create_token_node_with_token(&last, COMMENT, comment);
-        free(comment);
-        continue;
-      }
-      if(error)
-        continue;
-    }
+  return error;
+}
 
-    if(c == '/' && peek(file) == '*') {
-      ungetc(c, file);
-      char *comment = NULL;
-      error = read_block_comment(file, &comment);
-      if(comment) {
-        error = create_token_node_with_token(&last, COMMENT, comment);
-        free(comment);
-        continue;
-      }
-      if(error)
-        continue;
+bool create_span_token_node(token_node **last, enum token_type type,
+    const char *value, size_t pos, size_t len)
+{
+  bool error = create_token_node_with_token(last, type, value);
+  if(!error) {
+    (*last)->offset = pos;
+    (*last)->length = len;
+  }
+  return error;
+}
+
+char *tokens_to_str(const token_node *head)
+{
+  buffer buf = { NULL, 0, 0 };
+  for(; head; head = head->next) {
+    const char *value = head->type == IDENTIFIER ?
+      ((identifier_token *)head->token)->value : ((token *)head->token)->value;
+    if(write_buf_str(&buf, value)) {
+      free(buf.ptr);
+      return NULL;
     }
+  }
+  return buf_to_str(&buf, true);
+}
+
+bool append_token_copies(const token_node *first, const token_node *last,
+    token_node **tail)
+{
+  bool error = false;
+  for(const token_node *curr = first; !error && curr != last->next;
+      curr = curr->next) {
+    error = create_span_token_node(tail, curr->type,
+        ((token *)curr->token)->value, curr->offset, curr->length);
+    if(!error)
+      (*tail)->flags |= curr->flags & HAS_NEWLINE;
+  }
+  return error;
+}
+
+bool copy_token_nodes(const token_node *head, token_node **copy)
+{
+  token_node *last = NULL;
+  bool error = false;
+  for(; !error && head; head = head->next) {
+    const char *value = head->type == IDENTIFIER ?
+      ((identifier_token *)head->token)->value : ((token *)head->token)->value;
+    error = create_span_token_node(&last, head->type, value, head->offset,
+        head->length);
+    if(!error)
+      last->flags |= head->flags & HAS_NEWLINE;
+    if(!error && !*copy)
+      *copy = last;
+  }
+
+  if(error) {
+    free_token_nodes(*copy);
+    *copy = NULL;
+  }
+
+  return error;
+}
+
+bool tokenize_next(const char *src, size_t len, size_t *pos, token_node **last)
+{
+  size_t p = *pos;
+  int c = char_at(src, len, p);
+  int next = char_at(src, len, p + 1);
+  size_t n = 0;
+  bool error = false;
 
-    if(c == '_' && !is_name(peek(file), 1)) {
-      error = create_token_node_with_token(&last, KEYWORD, "_");
-      continue;
+  if(has_class(c, CC_SPACE)) {
+    // Runs are a single token, their value is a single space
+    n = scan_is(src, len, p, is_space);
+    error = create_span_token_node(last, WHITESPACE, " ", p, n);
+    if(!error && memchr(src + p, '\n', n))
+      (*last)->flags |= HAS_NEWLINE;
+  }
+  else if(c == '$' && next == '{')
+    error = create_token_node_from_src(last, SUBSTITUTION, src, p,
+        n = scan_until(src, len, p, "}"));
+  else if(c == '#')
+    error = create_token_node_from_src(last, DIRECTIVE, src, p,
+        n = scan_until(src, len, p, "\n"));
+  else if(c == '/' && next == '/')
+    error = create_token_node_from_src(last, COMMENT, src, p,
+        n = scan_until(src, len, p, "\n"));
+  else if(c == '/' && next == '*')
+    error = create_token_node_from_src(last, COMMENT, src, p,
+        n = scan_block_comment(src, len, p));
+  else if(c == '_' && (n = scan_name(src, len, p)) == 1)
+    error = create_span_token_node(last, KEYWORD, "_", p, n);
+  else if((n = scan_name(src, len, p)) > 0) {
+    char name[64];
+    bool keyword = false;
+    if(n < sizeof(name)) {
+      memcpy(name, src + p, n);
+      name[n] = '\0';
+      keyword = is_keyword(name);
     }
+    error = create_token_node_from_src(last, keyword ? KEYWORD : IDENTIFIER,
+        src, p, n);
+  } else if(has_class(c, CC_DIGIT) || (c == '.' && has_class(next, CC_DIGIT)))
+    error = create_token_node_from_src(last, LITERAL, src, p,
+        n = scan_is(src, len, p, is_number));
+  else if(has_class(c, CC_PUNCT) && (n = scan_symbol(src, len, p)) > 0)
+    error = create_token_node_from_src(last, SYMBOL, src, p, n);
+  else {
+    fprintf(stderr, ">>> UNKNOWN TOKEN: '%c'\n", c);
+    n = 1;
+  }
 
-    if(is_name(c, 0)) {
-      ungetc(c, file);
-      char *name;
-      error = read_until_is(file, &name, is_name);
-      if(!error) {
-        if(is_keyword(name))
-          error = create_token_node_with_token(&last, KEYWORD, name);
-        else
-          error = create_token_node_with_token(&last, IDENTIFIER, name);
-      }
-      free(name);
-      continue;
+  *pos = p + n;
+
+  return error;
+}
+
+bool tokenize_str(const char *src, size_t len, token_node **head)
+{
+  bool error = false;
+  token_node *last = *head;
+  size_t pos = 0;
+
+  while(!error && pos < len)
+    error = tokenize_next(src, len, &pos, &last);
+
+  if(!error && last) {
+    while(last->prev)
+      last = last->prev;
+    *head = last;
+  } else {
+    while(last && last->prev)
+      last = last->prev;
+    free_token_nodes(last);
+    *head = NULL;
+  }
+
+  return error;
+}
+
+// Finds up to count - 1 positions, each behind the whitespace run containing
+// the first newline following a multiple of len / count that is not part of a
+// comment, substitution or directive. The serial tokenizer starts a token at
+// each of these positions.
+size_t find_split_points(const char *src, size_t len, size_t *splits,
+    size_t count)
+{
+  enum { CODE, LINE, BLOCK, SUBST } state = CODE;
+  size_t n = 0, depth = 0;
+  for(size_t i=0; i<len && n + 1 < count; i++) {
+    char c = src[i];
+    char next = i + 1 < len ? src[i + 1] : '\0';
+    if(state == LINE && c == '\n')
+      state = CODE;
+    switch(state) {
+      case CODE:
+        if(c == '\n' && i + 1 >= (n + 1) * (len / count)) {
+          while(i + 1 < len && has_class(src[i + 1], CC_SPACE))
+            i++;
+          splits[n++] = i + 1;
+        }
+        else if(c == '#' || (c == '/' && next == '/'))
+          state = LINE;
+        else if(c == '/' && next == '*') {
+          state = BLOCK;
+          depth = 1;
+        } else if(c == '$' && next == '{')
+          state = SUBST;
+        break;
+      case LINE:
+        break;
+      case BLOCK:
+        // Same nesting rules as scan_block_comment()
+        if(c == '/' && next == '*')
+          depth++;
+        else if(c == '*' && next == '/' && --depth == 0) {
+          state = CODE;
+          i++;
+        }
+        break;
+      case SUBST:
+        if(c == '}')
+          state = CODE;
+        break;
     }
+  }
+
+  return n;
+}
+
+int tokenize_chunk(void *arg)
+{
+  uint64_t begin = trace_begin();
+  chunk *ch = arg;
+  token_arena *prev_arena = current_arena;
+  current_arena = ch->arena;
+  size_t pos = ch->start;
+  while(!ch->error && pos < ch->end) {
+    ch->error = tokenize_next(ch->src, ch->len, &pos, &ch->last);
+    if(!ch->error && !ch->head)
+      ch->head = ch->last;
+  }
+  current_arena = prev_arena;
+  trace_end("tokenize_chunk", begin);
+  return 0;
+}
 
-    if(isdigit(c) || (c == '.' && isdigit(peek(file)))) {
-      ungetc(c, file);
-      char *num;
-      error = read_until_is(file, &num, is_number);
+bool tokenize_parallel(const char *src, size_t len, size_t threads,
+    token_node **head)
+{
+  if(threads > len / MIN_CHUNK_SIZE)
+    threads = len / MIN_CHUNK_SIZE;
+  if(threads <= 1)
+    return tokenize_str(src, len, head);
+
+  size_t *splits = malloc((threads - 1) * sizeof(*splits));
+  chunk *chunks = malloc(threads * sizeof(*chunks));
+  if(!splits || !chunks) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(splits);
+    free(chunks);
+    return true;
+  }
+
+  // Each thread allocates from its own arena owned by the current one
+  bool error = false;
+  size_t count = find_split_points(src, len, splits, threads) + 1;
+  for(size_t i=0; i<count; i++) {
+    chunks[i] = (chunk){ src, len, i > 0 ? splits[i - 1] : 0,
+      i + 1 < count ? splits[i] : len, NULL, NULL, NULL, false };
+    if(current_arena && !error) {
+      chunks[i].arena = create_token_arena();
+      error = !chunks[i].arena;
       if(!error) {
-        error = create_token_node_with_token(&last, LITERAL, num);
+        chunks[i].arena->next = current_arena->children;
+        current_arena->children = chunks[i].arena;
       }
-      free(num);
-      continue;
     }
+  }
+  if(!error)
+    run_tasks(tokenize_chunk, chunks, sizeof(*chunks), count);
+
+  token_node *last = NULL;
+  for(size_t i=0; i<count; i++) {
+    error = error || chunks[i].error;
+    if(chunks[i].head) {
+      if(last) {
+        last->next = chunks[i].head;
+        chunks[i].head->prev = last;
+      } else
+        *head = chunks[i].head;
+      last = chunks[i].last;
+    }
+  }
+
+  if(error) {
+    free_token_nodes(*head);
+    *head = NULL;
+  }
+
+  free(splits);
+  free(chunks);
+
+  return error;
+}
 
-    if(ispunct(c) != 0) {
-      ungetc(c, file);
-      char *symbol;
-      error = read_symbol(file, &symbol);
-      if(symbol) {
-        error = create_token_node_with_token(&last, SYMBOL, symbol);
-        free(symbol);
-        continue;
+bool read_file(FILE *file, char **src, size_t *len)
+{
+  char *ptr = NULL;
+  size_t size = 0, pos = 0, n;
+  bool error = false;
+  do {
+    if(pos == size) {
+      size_t new_size = size ? 2 * size : 4096;
+      char *new_ptr = mem_realloc(MEM_SOURCE, ptr, size, new_size);
+      if(!new_ptr) {
+        fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+        error = true;
+        break;
       }
-      if(error)
-        continue;
+      ptr = new_ptr;
+      size = new_size;
     }
+    n = fread(ptr + pos, 1, size - pos, file);
+    pos += n;
+  } while(n > 0);
 
-    printf(">>> UNKNOWN TOKEN: '%c'\n", c);
+  if(!error && ferror(file) != 0) {
+    fprintf(stderr, "Failed to read file: %s\n", strerror(errno));
+    error = true;
   }
 
-  if(ferror(file) != 0) {
-    fprintf(stderr, "Failed to read file: %s\n", strerror(errno));
+  // Shrink to the text plus terminating zero, which free_source() relies on
+  char *shrunk = error ? NULL : mem_realloc(MEM_SOURCE, ptr, size, pos + 1);
+  if(!error && !shrunk) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
     error = true;
   }
 
-  if(!error && last) {
-    while(last->prev)
-      last = last->prev;
-    *head = last;
-  } else {
-    free_token_nodes(last);
-    *head = NULL;
+  if(error) {
+    mem_free(MEM_SOURCE, ptr, size);
+    return true;
   }
 
+  shrunk[pos] = '\0';
+  *src = shrunk;
+  *len = pos;
+
+  return false;
+}
+
+void free_source(char *src, size_t len)
+{
+  mem_free(MEM_SOURCE, src, len + 1);
+}
+
+bool tokenize(FILE *file, token_node **head)
+{
+  char *src;
+  size_t len;
+  if(read_file(file, &src, &len))
+    return true;
+
+  bool error = tokenize_str(src, len, head);
+  free_source(src, len);
+
   return error;
 }
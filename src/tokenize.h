@@ -13,11 +13,21 @@ typedef enum token_type {
   SYMBOL,
   WHITESPACE,
   SUBSTITUTION, // Non-WGSL ${expr} javascript template literal
+  DIRECTIVE,    // Non-WGSL #directive up to the end of the line
 } token_type;
 
+// Flags of token nodes loaded from a token stream or allocated from an arena
+#define NODE_POOLED    1 // Node and token are freed with the stream or arena
+#define VALUE_BORROWED 2 // Value is owned by the stream, arena or mangler
+// Whitespace runs are a single token with value " " spanning the whole run
+#define HAS_NEWLINE    4 // Whitespace run containing a line break
+
 typedef struct token_node {
   void *token;
   token_type type;
+  unsigned char flags;
+  size_t offset; // Source span, zero for tokens created by later passes
+  size_t length;
   struct token_node *prev;
   struct token_node *next;
 } token_node;
@@ -26,16 +36,61 @@ typedef struct token {
   char *value;
 } token;
 
+typedef enum identifier_access {
+  PLAIN,             // Any name that is not accessed via '.'
+  MEMBER,            // Struct member declaration or access on a known struct
+  SWIZZLE,           // Swizzle of a vector or other non-struct value
+  UNRESOLVED_MEMBER, // Member access on a value of unknown type
+} identifier_access;
+
 typedef struct identifier_token {
   char *value;
   void *data;
+  identifier_access access;
+  void *owner; // Struct declaration of MEMBER identifiers
 } identifier_token;
 
+// Arena for compact token storage. While an arena is set for the calling
+// thread, new nodes and tokens are allocated from it and equal values are
+// stored only once. They are released all at once by free_token_arena().
+typedef struct token_arena token_arena;
+
+token_arena *create_token_arena(void);
+void set_token_arena(token_arena *arena);
+// Releases all tokens of the arena but keeps its blocks and intern table for
+// reuse
+void reset_token_arena(token_arena *arena);
+void free_token_arena(token_arena *arena);
+
 bool tokenize(FILE *file, token_node **head);
+bool tokenize_str(const char *src, size_t len, token_node **head);
+// Tokenizes chunks of large inputs on up to the given number of threads
+bool tokenize_parallel(const char *src, size_t len, size_t threads,
+    token_node **head);
+bool tokenize_next(const char *src, size_t len, size_t *pos, token_node **last);
+// Reads the whole file, the source is zero terminated and released with
+// free_source()
+bool read_file(FILE *file, char **src, size_t *len);
+void free_source(char *src, size_t len);
+bool create_token_node_with_token(token_node **last, enum token_type type,
+    const char *value);
 void print_tokens(const token_node *head);
 void print_tokens_as_text(const token_node *head);
+void write_tokens_as_text(FILE *file, const token_node *head);
+char *tokens_to_str(const token_node *head);
+bool copy_token_nodes(const token_node *head, token_node **copy);
+// Appends copies of the nodes from first up to and including last to tail
+bool append_token_copies(const token_node *first, const token_node *last,
+    token_node **tail);
+bool set_token_value(token_node *node, const char *value, size_t len);
+// Replaces the value by one owned elsewhere that outlives the node
+void share_token_value(token_node *node, char *value);
 void free_token_node(token_node *node);
 void free_token_nodes(token_node *head);
+void splice_nodes(token_node **head, token_node *first, token_node *last,
+    token_node *repl);
 bool is_name(char c, size_t pos);
+size_t scan_name(const char *src, size_t len, size_t pos);
+bool is_keyword(const char *name);
 
 #endif
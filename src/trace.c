@@ -0,0 +1,148 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+typedef struct trace_event {
+  const char *name;
+  uint64_t begin; // Nanoseconds since start_trace()
+  uint64_t duration;
+  unsigned thread;
+} trace_event;
+
+bool trace_enabled;
+bool trace_failed; // Events were dropped since they could not be stored
+const char *trace_file;
+uint64_t trace_origin;
+mtx_t trace_lock;
+trace_event *trace_events;
+size_t trace_count;
+size_t trace_capacity;
+atomic_uint trace_threads;
+_Thread_local unsigned trace_thread; // Zero until the first span is recorded
+
+uint64_t trace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void start_trace(const char *file)
+{
+  trace_enabled = mtx_init(&trace_lock, mtx_plain) == thrd_success;
+  if(!trace_enabled) {
+    fprintf(stderr, "Failed to initialize tracing\n");
+    return;
+  }
+  trace_file = file ? file : "stdin";
+  trace_origin = trace_now();
+  // The calling thread is the main track
+  trace_thread = atomic_fetch_add(&trace_threads, 1) + 1;
+}
+
+uint64_t trace_begin(void)
+{
+  return trace_enabled ? trace_now() - trace_origin : 0;
+}
+
+void trace_end(const char *name, uint64_t begin)
+{
+  if(!trace_enabled)
+    return;
+
+  uint64_t end = trace_now() - trace_origin;
+  if(!trace_thread)
+    trace_thread = atomic_fetch_add(&trace_threads, 1) + 1;
+
+  mtx_lock(&trace_lock);
+  if(trace_count == trace_capacity) {
+    size_t capacity = trace_capacity ? 2 * trace_capacity : 256;
+    trace_event *events = realloc(trace_events, capacity * sizeof(*events));
+    if(events) {
+      trace_events = events;
+      trace_capacity = capacity;
+    }
+  }
+  if(trace_count < trace_capacity)
+    trace_events[trace_count++] = (trace_event){ name, begin, end - begin,
+      trace_thread };
+  else
+    trace_failed = true;
+  mtx_unlock(&trace_lock);
+}
+
+void write_json_string(FILE *file, const char *str)
+{
+  fputc('"', file);
+  for(; *str; str++) {
+    if(*str == '"' || *str == '\\')
+      fprintf(file, "\\%c", *str);
+    else if((unsigned char)*str < 0x20)
+      fprintf(file, "\\u%04x", *str);
+    else
+      fputc(*str, file);
+  }
+  fputc('"', file);
+}
+
+bool write_trace(const char *filename)
+{
+  if(!trace_enabled)
+    return true;
+
+  if(trace_failed)
+    fprintf(stderr, "Allocation failed: trace is incomplete\n");
+
+  FILE *file = fopen(filename, "w");
+  if(!file) {
+    fprintf(stderr, "Failed to open '%s': %s\n", filename, strerror(errno));
+    return true;
+  }
+
+  // Timestamps are given in microseconds
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  unsigned threads = atomic_load(&trace_threads);
+  for(unsigned i=1; i<=threads; i++)
+    fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+        "\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}", i > 1 ? "," : "", i,
+        i == 1 ? "main" : "worker", i);
+  mtx_lock(&trace_lock);
+  for(size_t i=0; i<trace_count; i++) {
+    const trace_event *e = &trace_events[i];
+    fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"wgslminify\",\"ph\":\"X\","
+        "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"file\":",
+        e->name, e->begin / 1000.0, e->duration / 1000.0, e->thread);
+    write_json_string(file, trace_file);
+    fprintf(file, "}}");
+  }
+  mtx_unlock(&trace_lock);
+  fprintf(file, "\n]}\n");
+
+  bool error = ferror(file) != 0;
+  if(error)
+    fprintf(stderr, "Failed to write '%s': %s\n", filename, strerror(errno));
+  if(fclose(file) != 0) {
+    fprintf(stderr, "Failed to close file: %s\n", strerror(errno));
+    error = true;
+  }
+
+  return error;
+}
+
+void stop_trace(void)
+{
+  if(!trace_enabled)
+    return;
+  trace_enabled = false;
+  mtx_destroy(&trace_lock);
+  free(trace_events);
+  trace_events = NULL;
+  trace_count = 0;
+  trace_capacity = 0;
+}
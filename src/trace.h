@@ -0,0 +1,16 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timeline of the run in Chrome trace event format. Spans are recorded from
+// any thread once tracing was started, each thread shows up as its own track.
+// Span names are not copied and have to be string literals.
+void start_trace(const char *file); // File tag of all spans, NULL for stdin
+uint64_t trace_begin(void);
+void trace_end(const char *name, uint64_t begin);
+bool write_trace(const char *filename);
+void stop_trace(void);
+
+#endif
@@ -0,0 +1,48 @@
+#include "unicode.h"
+
+size_t decode_utf8(const char *src, size_t len, size_t pos, uint32_t *cp)
+{
+  const unsigned char *s = (const unsigned char *)src + pos;
+  size_t n = s[0] < 0x80 ? 1 : s[0] < 0xc2 ? 0 : s[0] < 0xe0 ? 2 :
+    s[0] < 0xf0 ? 3 : s[0] < 0xf5 ? 4 : 0;
+  if(n == 0 || pos + n > len)
+    return 0;
+
+  uint32_t c = n == 1 ? s[0] : s[0] & (0x7f >> n);
+  for(size_t i=1; i<n; i++) {
+    if((s[i] & 0xc0) != 0x80)
+      return 0;
+    c = c << 6 | (s[i] & 0x3f);
+  }
+  // Overlong encodings, surrogates and code points beyond U+10FFFF
+  if((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10ffff)) ||
+      (c >= 0xd800 && c <= 0xdfff))
+    return 0;
+  *cp = c;
+
+  return n;
+}
+
+bool in_ranges(const uint32_t *ranges, size_t count, uint32_t cp)
+{
+  // Find the last range starting at or before the code point
+  size_t lo = 0, hi = count;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(ranges[mid] >> 11 <= cp)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo > 0 && cp - (ranges[lo - 1] >> 11) <= (ranges[lo - 1] & 0x7ff);
+}
+
+bool is_xid_start(uint32_t cp)
+{
+  return in_ranges(xid_start, xid_start_count, cp);
+}
+
+bool is_xid_continue(uint32_t cp)
+{
+  return in_ranges(xid_continue, xid_continue_count, cp);
+}
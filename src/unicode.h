@@ -0,0 +1,25 @@
+#ifndef UNICODE_H
+#define UNICODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sorted code point ranges of non-ASCII identifier characters. Each entry
+// holds the first code point shifted left by 11 and the length - 1 of the
+// range in the low bits.
+extern const uint32_t xid_start[];
+extern const size_t xid_start_count;
+extern const uint32_t xid_continue[];
+extern const size_t xid_continue_count;
+
+// Longest UTF-8 sequence in bytes
+#define MAX_UTF8_LENGTH 4
+
+// Code point of the UTF-8 sequence at pos and its length in bytes, 0 if the
+// sequence is invalid
+size_t decode_utf8(const char *src, size_t len, size_t pos, uint32_t *cp);
+bool is_xid_start(uint32_t cp);
+bool is_xid_continue(uint32_t cp);
+
+#endif
@@ -0,0 +1,262 @@
+// Generated by tools/unicode_tables.py from Unicode 14.0.0, do not edit
+#include "unicode.h"
+
+const uint32_t xid_start[] = {
+  0x00055000, 0x0005a800, 0x0005d000, 0x00060016, 0x0006c01e, 0x0007c1c9,
+  0x0016300b, 0x00170004, 0x00176000, 0x00177000, 0x001b8004, 0x001bb001,
+  0x001bd802, 0x001bf800, 0x001c3000, 0x001c4002, 0x001c6000, 0x001c7013,
+  0x001d1852, 0x001fb88a, 0x002450a5, 0x00298825, 0x002ac800, 0x002b0028,
+  0x002e801a, 0x002f7803, 0x0031002a, 0x00337001, 0x00338862, 0x0036a800,
+  0x00372801, 0x00377001, 0x0037d002, 0x0037f800, 0x00388000, 0x0038901d,
+  0x003a6858, 0x003d8800, 0x003e5020, 0x003fa001, 0x003fd000, 0x00400015,
+  0x0040d000, 0x00412000, 0x00414000, 0x00420018, 0x0043000a, 0x00438017,
+  0x00444805, 0x00450029, 0x00482035, 0x0049e800, 0x004a8000, 0x004ac009,
+  0x004b880f, 0x004c2807, 0x004c7801, 0x004c9815, 0x004d5006, 0x004d9000,
+  0x004db003, 0x004de800, 0x004e7000, 0x004ee001, 0x004ef802, 0x004f8001,
+  0x004fe000, 0x00502805, 0x00507801, 0x00509815, 0x00515006, 0x00519001,
+  0x0051a801, 0x0051c001, 0x0052c803, 0x0052f000, 0x00539002, 0x00542808,
+  0x00547802, 0x00549815, 0x00555006, 0x00559001, 0x0055a804, 0x0055e800,
+  0x00568000, 0x00570001, 0x0057c800, 0x00582807, 0x00587801, 0x00589815,
+  0x00595006, 0x00599001, 0x0059a804, 0x0059e800, 0x005ae001, 0x005af802,
+  0x005b8800, 0x005c1800, 0x005c2805, 0x005c7002, 0x005c9003, 0x005cc801,
+  0x005ce000, 0x005cf001, 0x005d1801, 0x005d4002, 0x005d700b, 0x005e8000,
+  0x00602807, 0x00607002, 0x00609016, 0x0061500f, 0x0061e800, 0x0062c002,
+  0x0062e800, 0x00630001, 0x00640000, 0x00642807, 0x00647002, 0x00649016,
+  0x00655009, 0x0065a804, 0x0065e800, 0x0066e801, 0x00670001, 0x00678801,
+  0x00682008, 0x00687002, 0x00689028, 0x0069e800, 0x006a7000, 0x006aa002,
+  0x006af802, 0x006bd005, 0x006c2811, 0x006cd017, 0x006d9808, 0x006de800,
+  0x006e0006, 0x0070082f, 0x00719000, 0x00720006, 0x00740801, 0x00742000,
+  0x00743004, 0x00746017, 0x00752800, 0x00753809, 0x00759000, 0x0075e800,
+  0x00760004, 0x00763000, 0x0076e003, 0x00780000, 0x007a0007, 0x007a4823,
+  0x007c4004, 0x0080002a, 0x0081f800, 0x00828005, 0x0082d003, 0x00830800,
+  0x00832801, 0x00837002, 0x0083a80c, 0x00847000, 0x00850025, 0x00863800,
+  0x00866800, 0x0086802a, 0x0087e14c, 0x00925003, 0x00928006, 0x0092c000,
+  0x0092d003, 0x00930028, 0x00945003, 0x00948020, 0x00959003, 0x0095c006,
+  0x00960000, 0x00961003, 0x0096400e, 0x0096c038, 0x00989003, 0x0098c042,
+  0x009c000f, 0x009d0055, 0x009fc005, 0x00a00a6b, 0x00b37810, 0x00b40819,
+  0x00b5004a, 0x00b7700a, 0x00b80011, 0x00b8f812, 0x00ba0011, 0x00bb000c,
+  0x00bb7002, 0x00bc0033, 0x00beb800, 0x00bee000, 0x00c10058, 0x00c40028,
+  0x00c55000, 0x00c58045, 0x00c8001e, 0x00ca801d, 0x00cb8004, 0x00cc002b,
+  0x00cd8019, 0x00d00016, 0x00d10034, 0x00d53800, 0x00d8282e, 0x00da2807,
+  0x00dc181d, 0x00dd7001, 0x00ddd02b, 0x00e00023, 0x00e26802, 0x00e2d023,
+  0x00e40008, 0x00e4802a, 0x00e5e802, 0x00e74803, 0x00e77005, 0x00e7a801,
+  0x00e7d000, 0x00e800bf, 0x00f00115, 0x00f8c005, 0x00f90025, 0x00fa4005,
+  0x00fa8007, 0x00fac800, 0x00fad800, 0x00fae800, 0x00faf81e, 0x00fc0034,
+  0x00fdb006, 0x00fdf000, 0x00fe1002, 0x00fe3006, 0x00fe8003, 0x00feb005,
+  0x00ff000c, 0x00ff9002, 0x00ffb006, 0x01038800, 0x0103f800, 0x0104800c,
+  0x01081000, 0x01083800, 0x01085009, 0x0108a800, 0x0108c005, 0x01092000,
+  0x01093000, 0x01094000, 0x0109500f, 0x0109e003, 0x010a2804, 0x010a7000,
+  0x010b0028, 0x016000e4, 0x01675803, 0x01679001, 0x01680025, 0x01693800,
+  0x01696800, 0x01698037, 0x016b7800, 0x016c0016, 0x016d0006, 0x016d4006,
+  0x016d8006, 0x016dc006, 0x016e0006, 0x016e4006, 0x016e8006, 0x016ec006,
+  0x01802802, 0x01810808, 0x01818804, 0x0181c004, 0x01820855, 0x0184e802,
+  0x01850859, 0x0187e003, 0x0188282a, 0x0189885d, 0x018d001f, 0x018f800f,
+  0x01a007ff, 0x01e007ff, 0x022007ff, 0x026001bf, 0x027007ff, 0x02b007ff,
+  0x02f007ff, 0x033007ff, 0x037007ff, 0x03b007ff, 0x03f007ff, 0x043007ff,
+  0x047007ff, 0x04b007ff, 0x04f0068c, 0x0526802d, 0x0528010c, 0x0530800f,
+  0x05315001, 0x0532002e, 0x0533f81e, 0x0535004f, 0x0538b808, 0x05391066,
+  0x053c583f, 0x053e8001, 0x053e9800, 0x053ea804, 0x053f900f, 0x05401802,
+  0x05403803, 0x05406016, 0x05420033, 0x05441031, 0x05479005, 0x0547d800,
+  0x0547e801, 0x0548501b, 0x05498016, 0x054b001c, 0x054c202e, 0x054e7800,
+  0x054f0004, 0x054f3009, 0x054fd004, 0x05500028, 0x05520002, 0x05522007,
+  0x05530016, 0x0553d000, 0x0553f031, 0x05558800, 0x0555a801, 0x0555c804,
+  0x05560000, 0x05561000, 0x0556d802, 0x0557000a, 0x05579002, 0x05580805,
+  0x05584805, 0x05588805, 0x05590006, 0x05594006, 0x0559802a, 0x055ae00d,
+  0x055b8072, 0x056007ff, 0x05a007ff, 0x05e007ff, 0x062007ff, 0x066007ff,
+  0x06a003a3, 0x06bd8016, 0x06be5830, 0x07c8016d, 0x07d38069, 0x07d80006,
+  0x07d89804, 0x07d8e800, 0x07d8f809, 0x07d9500c, 0x07d9c004, 0x07d9f000,
+  0x07da0001, 0x07da1801, 0x07da306b, 0x07de988a, 0x07e320d9, 0x07ea803f,
+  0x07ec9035, 0x07ef8009, 0x07f38800, 0x07f39800, 0x07f3b800, 0x07f3c800,
+  0x07f3d800, 0x07f3e800, 0x07f3f87d, 0x07f90819, 0x07fa0819, 0x07fb3037,
+  0x07fd001e, 0x07fe1005, 0x07fe5005, 0x07fe9005, 0x07fed002, 0x0800000b,
+  0x08006819, 0x08014012, 0x0801e001, 0x0801f80e, 0x0802800d, 0x0804007a,
+  0x080a0034, 0x0814001c, 0x08150030, 0x0818001f, 0x0819681d, 0x081a8025,
+  0x081c001d, 0x081d0023, 0x081e4007, 0x081e8804, 0x0820009d, 0x08258023,
+  0x0826c023, 0x08280027, 0x08298033, 0x082b800a, 0x082be00e, 0x082c6006,
+  0x082ca001, 0x082cb80a, 0x082d180e, 0x082d9806, 0x082dd801, 0x08300136,
+  0x083a0015, 0x083b0007, 0x083c0005, 0x083c3829, 0x083d9008, 0x08400005,
+  0x08404000, 0x0840502b, 0x0841b801, 0x0841e000, 0x0841f816, 0x08430016,
+  0x0844001e, 0x08470012, 0x0847a001, 0x08480015, 0x08490019, 0x084c0037,
+  0x084df001, 0x08500000, 0x08508003, 0x0850a802, 0x0850c81c, 0x0853001c,
+  0x0854001c, 0x08560007, 0x0856481b, 0x08580035, 0x085a0015, 0x085b0012,
+  0x085c0011, 0x08600048, 0x08640032, 0x08660032, 0x08680023, 0x08740029,
+  0x08758001, 0x0878001c, 0x08793800, 0x08798015, 0x087b8011, 0x087d8014,
+  0x087f0016, 0x08801834, 0x08838801, 0x0883a800, 0x0884182c, 0x08868018,
+  0x08881823, 0x088a2000, 0x088a3800, 0x088a8022, 0x088bb000, 0x088c182f,
+  0x088e0803, 0x088ed000, 0x088ee000, 0x08900011, 0x08909818, 0x08940006,
+  0x08944000, 0x08945003, 0x0894780e, 0x0894f809, 0x0895802e, 0x08982807,
+  0x08987801, 0x08989815, 0x08995006, 0x08999001, 0x0899a804, 0x0899e800,
+  0x089a8000, 0x089ae804, 0x08a00034, 0x08a23803, 0x08a2f802, 0x08a4002f,
+  0x08a62001, 0x08a63800, 0x08ac002e, 0x08aec003, 0x08b0002f, 0x08b22000,
+  0x08b4002a, 0x08b5c000, 0x08b8001a, 0x08ba0006, 0x08c0002b, 0x08c5003f,
+  0x08c7f807, 0x08c84800, 0x08c86007, 0x08c8a801, 0x08c8c017, 0x08c9f800,
+  0x08ca0800, 0x08cd0007, 0x08cd5026, 0x08cf0800, 0x08cf1800, 0x08d00000,
+  0x08d05827, 0x08d1d000, 0x08d28000, 0x08d2e02d, 0x08d4e800, 0x08d58048,
+  0x08e00008, 0x08e05024, 0x08e20000, 0x08e3901d, 0x08e80006, 0x08e84001,
+  0x08e85825, 0x08ea3000, 0x08eb0005, 0x08eb3801, 0x08eb501f, 0x08ecc000,
+  0x08f70012, 0x08fd8000, 0x09000399, 0x0920006e, 0x092400c3, 0x097c8060,
+  0x0980042e, 0x0a200246, 0x0b400238, 0x0b52001e, 0x0b53804e, 0x0b56801d,
+  0x0b58002f, 0x0b5a0003, 0x0b5b1814, 0x0b5be812, 0x0b72003f, 0x0b78004a,
+  0x0b7a8000, 0x0b7c980c, 0x0b7f0001, 0x0b7f1800, 0x0b8007ff, 0x0bc007ff,
+  0x0c0007f7, 0x0c4004d5, 0x0c680008, 0x0d7f8003, 0x0d7fa806, 0x0d7fe801,
+  0x0d800122, 0x0d8a8002, 0x0d8b2003, 0x0d8b818b, 0x0de0006a, 0x0de3800c,
+  0x0de40008, 0x0de48009, 0x0ea00054, 0x0ea2b046, 0x0ea4f001, 0x0ea51000,
+  0x0ea52801, 0x0ea54803, 0x0ea5700b, 0x0ea5d800, 0x0ea5e806, 0x0ea62840,
+  0x0ea83803, 0x0ea86807, 0x0ea8b006, 0x0ea8f01b, 0x0ea9d803, 0x0eaa0004,
+  0x0eaa3000, 0x0eaa5006, 0x0eaa9153, 0x0eb54018, 0x0eb61018, 0x0eb6e01e,
+  0x0eb7e018, 0x0eb8b01e, 0x0eb9b018, 0x0eba801e, 0x0ebb8018, 0x0ebc501e,
+  0x0ebd5018, 0x0ebe2007, 0x0ef8001e, 0x0f08002c, 0x0f09b806, 0x0f0a7000,
+  0x0f14801d, 0x0f16002b, 0x0f3f0006, 0x0f3f4003, 0x0f3f6801, 0x0f3f800e,
+  0x0f4000c4, 0x0f480043, 0x0f4a5800, 0x0f700003, 0x0f70281a, 0x0f710801,
+  0x0f712000, 0x0f713800, 0x0f714809, 0x0f71a003, 0x0f71c800, 0x0f71d800,
+  0x0f721000, 0x0f723800, 0x0f724800, 0x0f725800, 0x0f726802, 0x0f728801,
+  0x0f72a000, 0x0f72b800, 0x0f72c800, 0x0f72d800, 0x0f72e800, 0x0f72f800,
+  0x0f730801, 0x0f732000, 0x0f733803, 0x0f736006, 0x0f73a003, 0x0f73c803,
+  0x0f73f000, 0x0f740009, 0x0f745810, 0x0f750802, 0x0f752804, 0x0f755810,
+  0x100007ff, 0x104007ff, 0x108007ff, 0x10c007ff, 0x110007ff, 0x114007ff,
+  0x118007ff, 0x11c007ff, 0x120007ff, 0x124007ff, 0x128007ff, 0x12c007ff,
+  0x130007ff, 0x134007ff, 0x138007ff, 0x13c007ff, 0x140007ff, 0x144007ff,
+  0x148007ff, 0x14c007ff, 0x150006df, 0x153807ff, 0x157807ff, 0x15b80038,
+  0x15ba00dd, 0x15c107ff, 0x160107ff, 0x16410681, 0x167587ff, 0x16b587ff,
+  0x16f587ff, 0x17358530, 0x17c0021d, 0x180007ff, 0x184007ff, 0x1880034a,
+};
+const size_t xid_start_count = 702;
+
+const uint32_t xid_continue[] = {
+  0x00055000, 0x0005a800, 0x0005b800, 0x0005d000, 0x00060016, 0x0006c01e,
+  0x0007c1c9, 0x0016300b, 0x00170004, 0x00176000, 0x00177000, 0x00180074,
+  0x001bb001, 0x001bd802, 0x001bf800, 0x001c3004, 0x001c6000, 0x001c7013,
+  0x001d1852, 0x001fb88a, 0x00241804, 0x002450a5, 0x00298825, 0x002ac800,
+  0x002b0028, 0x002c882c, 0x002df800, 0x002e0801, 0x002e2001, 0x002e3800,
+  0x002e801a, 0x002f7803, 0x0030800a, 0x00310049, 0x00337065, 0x0036a807,
+  0x0036f809, 0x00375012, 0x0037f800, 0x0038803a, 0x003a6864, 0x003e0035,
+  0x003fd000, 0x003fe800, 0x0040002d, 0x0042001b, 0x0043000a, 0x00438017,
+  0x00444805, 0x0044c049, 0x00471880, 0x004b3009, 0x004b8812, 0x004c2807,
+  0x004c7801, 0x004c9815, 0x004d5006, 0x004d9000, 0x004db003, 0x004de008,
+  0x004e3801, 0x004e5803, 0x004eb800, 0x004ee001, 0x004ef804, 0x004f300b,
+  0x004fe000, 0x004ff000, 0x00500802, 0x00502805, 0x00507801, 0x00509815,
+  0x00515006, 0x00519001, 0x0051a801, 0x0051c001, 0x0051e000, 0x0051f004,
+  0x00523801, 0x00525802, 0x00528800, 0x0052c803, 0x0052f000, 0x0053300f,
+  0x00540802, 0x00542808, 0x00547802, 0x00549815, 0x00555006, 0x00559001,
+  0x0055a804, 0x0055e009, 0x00563802, 0x00565802, 0x00568000, 0x00570003,
+  0x00573009, 0x0057c806, 0x00580802, 0x00582807, 0x00587801, 0x00589815,
+  0x00595006, 0x00599001, 0x0059a804, 0x0059e008, 0x005a3801, 0x005a5802,
+  0x005aa802, 0x005ae001, 0x005af804, 0x005b3009, 0x005b8800, 0x005c1001,
+  0x005c2805, 0x005c7002, 0x005c9003, 0x005cc801, 0x005ce000, 0x005cf001,
+  0x005d1801, 0x005d4002, 0x005d700b, 0x005df004, 0x005e3002, 0x005e5003,
+  0x005e8000, 0x005eb800, 0x005f3009, 0x0060000c, 0x00607002, 0x00609016,
+  0x0061500f, 0x0061e008, 0x00623002, 0x00625003, 0x0062a801, 0x0062c002,
+  0x0062e800, 0x00630003, 0x00633009, 0x00640003, 0x00642807, 0x00647002,
+  0x00649016, 0x00655009, 0x0065a804, 0x0065e008, 0x00663002, 0x00665003,
+  0x0066a801, 0x0066e801, 0x00670003, 0x00673009, 0x00678801, 0x0068000c,
+  0x00687002, 0x00689032, 0x006a3002, 0x006a5004, 0x006aa003, 0x006af804,
+  0x006b3009, 0x006bd005, 0x006c0802, 0x006c2811, 0x006cd017, 0x006d9808,
+  0x006de800, 0x006e0006, 0x006e5000, 0x006e7805, 0x006eb000, 0x006ec007,
+  0x006f3009, 0x006f9001, 0x00700839, 0x0072000e, 0x00728009, 0x00740801,
+  0x00742000, 0x00743004, 0x00746017, 0x00752800, 0x00753816, 0x00760004,
+  0x00763000, 0x00764005, 0x00768009, 0x0076e003, 0x00780000, 0x0078c001,
+  0x00790009, 0x0079a800, 0x0079b800, 0x0079c800, 0x0079f009, 0x007a4823,
+  0x007b8813, 0x007c3011, 0x007cc823, 0x007e3000, 0x00800049, 0x0082804d,
+  0x00850025, 0x00863800, 0x00866800, 0x0086802a, 0x0087e14c, 0x00925003,
+  0x00928006, 0x0092c000, 0x0092d003, 0x00930028, 0x00945003, 0x00948020,
+  0x00959003, 0x0095c006, 0x00960000, 0x00961003, 0x0096400e, 0x0096c038,
+  0x00989003, 0x0098c042, 0x009ae802, 0x009b4808, 0x009c000f, 0x009d0055,
+  0x009fc005, 0x00a00a6b, 0x00b37810, 0x00b40819, 0x00b5004a, 0x00b7700a,
+  0x00b80015, 0x00b8f815, 0x00ba0013, 0x00bb000c, 0x00bb7002, 0x00bb9001,
+  0x00bc0053, 0x00beb800, 0x00bee001, 0x00bf0009, 0x00c05802, 0x00c0780a,
+  0x00c10058, 0x00c4002a, 0x00c58045, 0x00c8001e, 0x00c9000b, 0x00c9800b,
+  0x00ca3027, 0x00cb8004, 0x00cc002b, 0x00cd8019, 0x00ce800a, 0x00d0001b,
+  0x00d1003e, 0x00d3001c, 0x00d3f80a, 0x00d48009, 0x00d53800, 0x00d5800d,
+  0x00d5f80f, 0x00d8004c, 0x00da8009, 0x00db5808, 0x00dc0073, 0x00e00037,
+  0x00e20009, 0x00e26830, 0x00e40008, 0x00e4802a, 0x00e5e802, 0x00e68002,
+  0x00e6a026, 0x00e80215, 0x00f8c005, 0x00f90025, 0x00fa4005, 0x00fa8007,
+  0x00fac800, 0x00fad800, 0x00fae800, 0x00faf81e, 0x00fc0034, 0x00fdb006,
+  0x00fdf000, 0x00fe1002, 0x00fe3006, 0x00fe8003, 0x00feb005, 0x00ff000c,
+  0x00ff9002, 0x00ffb006, 0x0101f801, 0x0102a000, 0x01038800, 0x0103f800,
+  0x0104800c, 0x0106800c, 0x01070800, 0x0107280b, 0x01081000, 0x01083800,
+  0x01085009, 0x0108a800, 0x0108c005, 0x01092000, 0x01093000, 0x01094000,
+  0x0109500f, 0x0109e003, 0x010a2804, 0x010a7000, 0x010b0028, 0x016000e4,
+  0x01675808, 0x01680025, 0x01693800, 0x01696800, 0x01698037, 0x016b7800,
+  0x016bf817, 0x016d0006, 0x016d4006, 0x016d8006, 0x016dc006, 0x016e0006,
+  0x016e4006, 0x016e8006, 0x016ec006, 0x016f001f, 0x01802802, 0x0181080e,
+  0x01818804, 0x0181c004, 0x01820855, 0x0184c801, 0x0184e802, 0x01850859,
+  0x0187e003, 0x0188282a, 0x0189885d, 0x018d001f, 0x018f800f, 0x01a007ff,
+  0x01e007ff, 0x022007ff, 0x026001bf, 0x027007ff, 0x02b007ff, 0x02f007ff,
+  0x033007ff, 0x037007ff, 0x03b007ff, 0x03f007ff, 0x043007ff, 0x047007ff,
+  0x04b007ff, 0x04f0068c, 0x0526802d, 0x0528010c, 0x0530801b, 0x0532002f,
+  0x0533a009, 0x0533f872, 0x0538b808, 0x05391066, 0x053c583f, 0x053e8001,
+  0x053e9800, 0x053ea804, 0x053f9035, 0x05416000, 0x05420033, 0x05440045,
+  0x05468009, 0x05470017, 0x0547d800, 0x0547e830, 0x05498023, 0x054b001c,
+  0x054c0040, 0x054e780a, 0x054f001e, 0x05500036, 0x0552000d, 0x05528009,
+  0x05530016, 0x0553d048, 0x0556d802, 0x0557000f, 0x05579004, 0x05580805,
+  0x05584805, 0x05588805, 0x05590006, 0x05594006, 0x0559802a, 0x055ae00d,
+  0x055b807a, 0x055f6001, 0x055f8009, 0x056007ff, 0x05a007ff, 0x05e007ff,
+  0x062007ff, 0x066007ff, 0x06a003a3, 0x06bd8016, 0x06be5830, 0x07c8016d,
+  0x07d38069, 0x07d80006, 0x07d89804, 0x07d8e80b, 0x07d9500c, 0x07d9c004,
+  0x07d9f000, 0x07da0001, 0x07da1801, 0x07da306b, 0x07de988a, 0x07e320d9,
+  0x07ea803f, 0x07ec9035, 0x07ef8009, 0x07f0000f, 0x07f1000f, 0x07f19801,
+  0x07f26802, 0x07f38800, 0x07f39800, 0x07f3b800, 0x07f3c800, 0x07f3d800,
+  0x07f3e800, 0x07f3f87d, 0x07f88009, 0x07f90819, 0x07f9f800, 0x07fa0819,
+  0x07fb3058, 0x07fe1005, 0x07fe5005, 0x07fe9005, 0x07fed002, 0x0800000b,
+  0x08006819, 0x08014012, 0x0801e001, 0x0801f80e, 0x0802800d, 0x0804007a,
+  0x080a0034, 0x080fe800, 0x0814001c, 0x08150030, 0x08170000, 0x0818001f,
+  0x0819681d, 0x081a802a, 0x081c001d, 0x081d0023, 0x081e4007, 0x081e8804,
+  0x0820009d, 0x08250009, 0x08258023, 0x0826c023, 0x08280027, 0x08298033,
+  0x082b800a, 0x082be00e, 0x082c6006, 0x082ca001, 0x082cb80a, 0x082d180e,
+  0x082d9806, 0x082dd801, 0x08300136, 0x083a0015, 0x083b0007, 0x083c0005,
+  0x083c3829, 0x083d9008, 0x08400005, 0x08404000, 0x0840502b, 0x0841b801,
+  0x0841e000, 0x0841f816, 0x08430016, 0x0844001e, 0x08470012, 0x0847a001,
+  0x08480015, 0x08490019, 0x084c0037, 0x084df001, 0x08500003, 0x08502801,
+  0x08506007, 0x0850a802, 0x0850c81c, 0x0851c002, 0x0851f800, 0x0853001c,
+  0x0854001c, 0x08560007, 0x0856481d, 0x08580035, 0x085a0015, 0x085b0012,
+  0x085c0011, 0x08600048, 0x08640032, 0x08660032, 0x08680027, 0x08698009,
+  0x08740029, 0x08755801, 0x08758001, 0x0878001c, 0x08793800, 0x08798020,
+  0x087b8015, 0x087d8014, 0x087f0016, 0x08800046, 0x0883300f, 0x0883f83b,
+  0x08861000, 0x08868018, 0x08878009, 0x08880034, 0x0889b009, 0x088a2003,
+  0x088a8023, 0x088bb000, 0x088c0044, 0x088e4803, 0x088e700c, 0x088ee000,
+  0x08900011, 0x08909824, 0x0891f000, 0x08940006, 0x08944000, 0x08945003,
+  0x0894780e, 0x0894f809, 0x0895803a, 0x08978009, 0x08980003, 0x08982807,
+  0x08987801, 0x08989815, 0x08995006, 0x08999001, 0x0899a804, 0x0899d809,
+  0x089a3801, 0x089a5802, 0x089a8000, 0x089ab800, 0x089ae806, 0x089b3006,
+  0x089b8004, 0x08a0004a, 0x08a28009, 0x08a2f003, 0x08a40045, 0x08a63800,
+  0x08a68009, 0x08ac0035, 0x08adc008, 0x08aec005, 0x08b00040, 0x08b22000,
+  0x08b28009, 0x08b40038, 0x08b60009, 0x08b8001a, 0x08b8e80e, 0x08b98009,
+  0x08ba0006, 0x08c0003a, 0x08c50049, 0x08c7f807, 0x08c84800, 0x08c86007,
+  0x08c8a801, 0x08c8c01d, 0x08c9b801, 0x08c9d808, 0x08ca8009, 0x08cd0007,
+  0x08cd502d, 0x08ced007, 0x08cf1801, 0x08d0003e, 0x08d23800, 0x08d28049,
+  0x08d4e800, 0x08d58048, 0x08e00008, 0x08e0502c, 0x08e1c008, 0x08e28009,
+  0x08e3901d, 0x08e49015, 0x08e5480d, 0x08e80006, 0x08e84001, 0x08e8582b,
+  0x08e9d000, 0x08e9e001, 0x08e9f808, 0x08ea8009, 0x08eb0005, 0x08eb3801,
+  0x08eb5024, 0x08ec8001, 0x08ec9805, 0x08ed0009, 0x08f70016, 0x08fd8000,
+  0x09000399, 0x0920006e, 0x092400c3, 0x097c8060, 0x0980042e, 0x0a200246,
+  0x0b400238, 0x0b52001e, 0x0b530009, 0x0b53804e, 0x0b560009, 0x0b56801d,
+  0x0b578004, 0x0b580036, 0x0b5a0003, 0x0b5a8009, 0x0b5b1814, 0x0b5be812,
+  0x0b72003f, 0x0b78004a, 0x0b7a7838, 0x0b7c7810, 0x0b7f0001, 0x0b7f1801,
+  0x0b7f8001, 0x0b8007ff, 0x0bc007ff, 0x0c0007f7, 0x0c4004d5, 0x0c680008,
+  0x0d7f8003, 0x0d7fa806, 0x0d7fe801, 0x0d800122, 0x0d8a8002, 0x0d8b2003,
+  0x0d8b818b, 0x0de0006a, 0x0de3800c, 0x0de40008, 0x0de48009, 0x0de4e801,
+  0x0e78002d, 0x0e798016, 0x0e8b2804, 0x0e8b6805, 0x0e8bd807, 0x0e8c2806,
+  0x0e8d5003, 0x0e921002, 0x0ea00054, 0x0ea2b046, 0x0ea4f001, 0x0ea51000,
+  0x0ea52801, 0x0ea54803, 0x0ea5700b, 0x0ea5d800, 0x0ea5e806, 0x0ea62840,
+  0x0ea83803, 0x0ea86807, 0x0ea8b006, 0x0ea8f01b, 0x0ea9d803, 0x0eaa0004,
+  0x0eaa3000, 0x0eaa5006, 0x0eaa9153, 0x0eb54018, 0x0eb61018, 0x0eb6e01e,
+  0x0eb7e018, 0x0eb8b01e, 0x0eb9b018, 0x0eba801e, 0x0ebb8018, 0x0ebc501e,
+  0x0ebd5018, 0x0ebe2007, 0x0ebe7031, 0x0ed00036, 0x0ed1d831, 0x0ed3a800,
+  0x0ed42000, 0x0ed4d804, 0x0ed5080e, 0x0ef8001e, 0x0f000006, 0x0f004010,
+  0x0f00d806, 0x0f011801, 0x0f013004, 0x0f08002c, 0x0f09800d, 0x0f0a0009,
+  0x0f0a7000, 0x0f14801e, 0x0f160039, 0x0f3f0006, 0x0f3f4003, 0x0f3f6801,
+  0x0f3f800e, 0x0f4000c4, 0x0f468006, 0x0f48004b, 0x0f4a8009, 0x0f700003,
+  0x0f70281a, 0x0f710801, 0x0f712000, 0x0f713800, 0x0f714809, 0x0f71a003,
+  0x0f71c800, 0x0f71d800, 0x0f721000, 0x0f723800, 0x0f724800, 0x0f725800,
+  0x0f726802, 0x0f728801, 0x0f72a000, 0x0f72b800, 0x0f72c800, 0x0f72d800,
+  0x0f72e800, 0x0f72f800, 0x0f730801, 0x0f732000, 0x0f733803, 0x0f736006,
+  0x0f73a003, 0x0f73c803, 0x0f73f000, 0x0f740009, 0x0f745810, 0x0f750802,
+  0x0f752804, 0x0f755810, 0x0fdf8009, 0x100007ff, 0x104007ff, 0x108007ff,
+  0x10c007ff, 0x110007ff, 0x114007ff, 0x118007ff, 0x11c007ff, 0x120007ff,
+  0x124007ff, 0x128007ff, 0x12c007ff, 0x130007ff, 0x134007ff, 0x138007ff,
+  0x13c007ff, 0x140007ff, 0x144007ff, 0x148007ff, 0x14c007ff, 0x150006df,
+  0x153807ff, 0x157807ff, 0x15b80038, 0x15ba00dd, 0x15c107ff, 0x160107ff,
+  0x16410681, 0x167587ff, 0x16b587ff, 0x16f587ff, 0x17358530, 0x17c0021d,
+  0x180007ff, 0x184007ff, 0x1880034a, 0x700800ef,
+};
+const size_t xid_continue_count = 808;
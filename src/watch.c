@@ -0,0 +1,190 @@
+#define _XOPEN_SOURCE 700
+#include "watch.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Time without events after which a burst of events is considered complete
+#define WATCH_DEBOUNCE_MS 50
+
+typedef struct changed_file {
+  char *name;
+  struct changed_file *next;
+} changed_file;
+
+bool is_shader_name(const char *name)
+{
+  const char *ext = strrchr(name, '.');
+  return ext && ext != name && strcmp(ext, ".wgsl") == 0;
+}
+
+bool add_changed_file(changed_file **first, const char *name)
+{
+  changed_file **last = first;
+  for(; *last; last = &(*last)->next)
+    if(strcmp((*last)->name, name) == 0)
+      return false;
+
+  changed_file *file = malloc(sizeof(*file));
+  char *copy = strdup(name);
+  if(!file || !copy) {
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+    free(file);
+    free(copy);
+    return true;
+  }
+  *file = (changed_file){ copy, NULL };
+  *last = file;
+
+  return false;
+}
+
+void free_changed_files(changed_file *first)
+{
+  while(first) {
+    changed_file *next = first->next;
+    free(first->name);
+    free(first);
+    first = next;
+  }
+}
+
+bool list_shaders(const char *dir, changed_file **first)
+{
+  DIR *d = opendir(dir);
+  if(!d) {
+    fprintf(stderr, "Failed to open '%s': %s\n", dir, strerror(errno));
+    return true;
+  }
+
+  bool error = false;
+  for(struct dirent *e = readdir(d); !error && e; e = readdir(d))
+    if(is_shader_name(e->d_name))
+      error = add_changed_file(first, e->d_name);
+  closedir(d);
+
+  return error;
+}
+
+char *join_path(const char *dir, const char *name)
+{
+  size_t len = strlen(dir) + strlen(name) + 2;
+  char *path = malloc(len);
+  if(path)
+    snprintf(path, len, "%s/%s", dir, name);
+  else
+    fprintf(stderr, "Allocation failed: %s\n", strerror(errno));
+  return path;
+}
+
+bool minify_changed(const char *dir, const char *out_dir,
+    const changed_file *first, watch_func func, void *data)
+{
+  for(const changed_file *file = first; file; file = file->next) {
+    char *src_path = join_path(dir, file->name);
+    char *dst_path = join_path(out_dir, file->name);
+    if(!src_path || !dst_path) {
+      free(src_path);
+      free(dst_path);
+      return true;
+    }
+    // Files removed in the meantime are skipped silently
+    if(access(src_path, R_OK) == 0) {
+      if(func(src_path, dst_path, data))
+        fprintf(stderr, "Failed to minify '%s'\n", src_path);
+      else
+        fprintf(stderr, "Minified '%s'\n", src_path);
+    }
+    free(src_path);
+    free(dst_path);
+  }
+
+  return false;
+}
+
+// Adds the shaders of all events that can be read without blocking
+bool read_events(int fd, changed_file **first)
+{
+  _Alignas(struct inotify_event) char buf[4096];
+  ssize_t len = read(fd, buf, sizeof(buf));
+  if(len < 0) {
+    if(errno == EINTR || errno == EAGAIN)
+      return false;
+    fprintf(stderr, "Failed to read events: %s\n", strerror(errno));
+    return true;
+  }
+
+  bool error = false;
+  const struct inotify_event *e;
+  for(char *p = buf; !error && p < buf + len; p += sizeof(*e) + e->len) {
+    e = (const struct inotify_event *)p;
+    if(e->mask & IN_Q_OVERFLOW)
+      fprintf(stderr, "Events were lost, save the files again\n");
+    else if(e->len > 0 && is_shader_name(e->name))
+      error = add_changed_file(first, e->name);
+  }
+
+  return error;
+}
+
+bool is_same_directory(const char *a, const char *b)
+{
+  char real_a[PATH_MAX], real_b[PATH_MAX];
+  return realpath(a, real_a) && realpath(b, real_b) &&
+    strcmp(real_a, real_b) == 0;
+}
+
+bool watch_directory(const char *dir, const char *out_dir, watch_func func,
+    void *data)
+{
+  if(is_same_directory(dir, out_dir)) {
+    fprintf(stderr, "Output directory has to differ from '%s'\n", dir);
+    return true;
+  }
+
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    fprintf(stderr, "Failed to watch '%s': %s\n", dir, strerror(errno));
+    if(fd >= 0)
+      close(fd);
+    return true;
+  }
+
+  changed_file *changed = NULL;
+  bool error = list_shaders(dir, &changed) ||
+    minify_changed(dir, out_dir, changed, func, data);
+  free_changed_files(changed);
+  changed = NULL;
+
+  while(!error) {
+    // Block until the first event, then until the burst is over
+    int timeout = -1;
+    while(!error) {
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      int ready = poll(&pfd, 1, timeout);
+      if(ready < 0 && errno != EINTR) {
+        fprintf(stderr, "Failed to wait for events: %s\n", strerror(errno));
+        error = true;
+      } else if(ready == 0)
+        break;
+      else if(ready > 0) {
+        error = read_events(fd, &changed);
+        timeout = changed ? WATCH_DEBOUNCE_MS : -1;
+      }
+    }
+
+    if(!error)
+      error = minify_changed(dir, out_dir, changed, func, data);
+    free_changed_files(changed);
+    changed = NULL;
+  }
+  close(fd);
+
+  return error;
+}
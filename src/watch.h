@@ -0,0 +1,17 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+
+// Minifies the file at src_path into dst_path
+typedef bool (*watch_func)(const char *src_path, const char *dst_path,
+    void *data);
+
+// Minifies all .wgsl files of dir into out_dir and again whenever one of them
+// is written or moved into dir. Events are collected until none arrived for
+// a short delay, so each file of a burst is minified once. Runs until an
+// error occurs, failing files are reported and do not stop watching.
+bool watch_directory(const char *dir, const char *out_dir, watch_func func,
+    void *data);
+
+#endif
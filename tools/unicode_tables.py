@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+# Generates src/unicode_tables.c with the XID_Start and XID_Continue ranges of
+# the Unicode version of the running Python, which classifies identifiers by
+# the same properties.
+import sys
+import unicodedata
+
+MAX_LENGTH = 1 << 11
+
+def ranges(pred):
+    res, first = [], None
+    for cp in range(0x80, 0x110000):
+        ok = not 0xd800 <= cp <= 0xdfff and pred(chr(cp))
+        if ok and first is None:
+            first = cp
+        elif not ok and first is not None:
+            res.append((first, cp - first))
+            first = None
+    if first is not None:
+        res.append((first, 0x110000 - first))
+    # Each entry holds the first code point and the length - 1 in 11 bits
+    packed = []
+    for first, length in res:
+        while length > 0:
+            n = min(length, MAX_LENGTH)
+            packed.append(first << 11 | (n - 1))
+            first += n
+            length -= n
+    return packed
+
+def table(name, packed):
+    lines = ["const uint32_t %s[] = {" % name]
+    for i in range(0, len(packed), 6):
+        lines.append("  " + " ".join("0x%08x," % v for v in packed[i:i + 6]))
+    lines.append("};")
+    lines.append("const size_t %s_count = %d;" % (name, len(packed)))
+    return "\n".join(lines)
+
+start = ranges(lambda c: c.isidentifier())
+cont = ranges(lambda c: ("a" + c).isidentifier())
+out = open(sys.argv[1] if len(sys.argv) > 1 else "src/unicode_tables.c", "w")
+out.write("// Generated by tools/unicode_tables.py from Unicode %s, do not edit\n"
+    % unicodedata.unidata_version)
+out.write('#include "unicode.h"\n\n')
+out.write(table("xid_start", start) + "\n\n")
+out.write(table("xid_continue", cont) + "\n")